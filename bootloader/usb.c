@@ -305,14 +305,38 @@ static void backup_metadata(uint8_t *backup)
 	memcpy(backup, FLASH_PTR(FLASH_META_START), FLASH_META_LEN);
 }
 
-static void restore_metadata(const uint8_t *backup)
+static bool flash_status_ok(uint32_t status)
+{
+	return (status & (FLASH_SR_PGAERR | FLASH_SR_PGPERR | FLASH_SR_PGSERR | FLASH_SR_WRPERR)) == 0;
+}
+
+static bool restore_metadata(const uint8_t *backup)
 {
 	flash_unlock();
-	for (int i = 0; i < FLASH_META_LEN / 4; i++) {
-		const uint32_t *w = (const uint32_t *)(backup + i * 4);
-		flash_program_word(FLASH_META_START + i * 4, *w);
-	}
+	uint32_t status = flash_program_words(FLASH_META_START, (const uint32_t *)backup, FLASH_META_LEN / 4);
 	flash_lock();
+	return flash_status_ok(status);
+}
+
+static bool flash_program_firmware(uint32_t pos, const uint32_t *src, uint32_t nwords)
+{
+	uint32_t status = 0;
+	// the first 256 bytes of firmware is metadata descriptor
+	if (pos < FLASH_META_DESC_LEN) {
+		uint32_t n = (FLASH_META_DESC_LEN - pos) / 4;
+		if (n > nwords) {
+			n = nwords;
+		}
+		status |= flash_program_words(FLASH_META_START + pos, src, n);
+		pos += n * 4;
+		src += n;
+		nwords -= n;
+	}
+	// the rest is code
+	if (nwords > 0) {
+		status |= flash_program_words(FLASH_APP_START + (pos - FLASH_META_DESC_LEN), src, nwords);
+	}
+	return flash_status_ok(status);
 }
 
 static void hid_rx_callback(usbd_device *dev, uint8_t ep)
@@ -583,23 +607,30 @@ static void hid_rx_callback(usbd_device *dev, uint8_t ep)
 			layoutProgress("INSTALLING ... Please wait", 1000 * flash_pos / flash_len);
 		}
 		flash_anim++;
-		flash_unlock();
+		// collect the complete words of this packet and program them at once
+		uint32_t words[64 / 4];
+		uint32_t nwords = 0;
+		uint32_t start_pos = flash_pos;
 		while (p < buf + 64 && flash_pos < flash_len) {
 			towrite[wi] = *p;
 			wi++;
 			if (wi == 4) {
-				const uint32_t *w = (const uint32_t *)towrite;
-				if (flash_pos < FLASH_META_DESC_LEN) {
-					flash_program_word(FLASH_META_START + flash_pos, *w);			// the first 256 bytes of firmware is metadata descriptor
-				} else {
-					flash_program_word(FLASH_APP_START + (flash_pos - FLASH_META_DESC_LEN), *w);	// the rest is code
-				}
+				memcpy(&words[nwords], towrite, 4);
+				nwords++;
 				flash_pos += 4;
 				wi = 0;
 			}
 			p++;
 		}
+		flash_unlock();
+		bool programmed = flash_program_firmware(start_pos, words, nwords);
 		flash_lock();
+		if (!programmed) {
+			send_msg_failure(dev);
+			flash_state = STATE_END;
+			layoutDialog(&bmp_icon_error, NULL, NULL, NULL, "Error installing ", "firmware.", NULL, "Unplug your TREZOR", "and try again.", NULL);
+			return;
+		}
 		// flashing done
 		if (flash_pos == flash_len) {
 			flash_state = STATE_CHECK;
@@ -649,11 +680,14 @@ static void hid_rx_callback(usbd_device *dev, uint8_t ep)
 		}
 
 		// no need to erase, because we are not changing any already flashed byte.
-		restore_metadata(meta_backup);
+		bool restored = restore_metadata(meta_backup);
 		memzero(meta_backup, sizeof(meta_backup));
 
 		flash_state = STATE_END;
-		if (hash_check_ok) {
+		if (!restored) {
+			layoutDialog(&bmp_icon_error, NULL, NULL, NULL, "Error installing ", "firmware.", NULL, "Unplug your TREZOR", "and try again.", NULL);
+			send_msg_failure(dev);
+		} else if (hash_check_ok) {
 			layoutDialog(&bmp_icon_ok, NULL, NULL, NULL, "New firmware", "successfully installed.", NULL, "You may now", "unplug your TREZOR.", NULL);
 			send_msg_success(dev);
 		} else {
@@ -24,11 +24,35 @@
 
 #include "strl.h"
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+
+/* DebugLinkFlashErase pseudo sectors for saving and restoring
+ * flash snapshots, the slot number is added to the base. The session
+ * (cached seed, passphrase, PIN and public keys) is saved with it.
+ */
+#define EMULATOR_SNAPSHOT_SLOTS   8
+#define EMULATOR_SNAPSHOT_SAVE    0x100
+#define EMULATOR_SNAPSHOT_RESTORE 0x200
+
+/* DebugLinkFlashErase pseudo sectors for advancing the virtual clock,
+ * the number of milliseconds (up to 0xffff) is added to the base.
+ */
+#define EMULATOR_CLOCK_ADVANCE    0x10000
 
 void emulatorPoll(void);
 void emulatorRandom(void *buffer, size_t size);
 
+bool emulatorFlashSnapshot(uint32_t slot);
+bool emulatorFlashRestore(uint32_t slot);
+
+void emulatorOledCounters(uint32_t *refreshes, uint32_t *bytes);
+void emulatorCaptureMessage(char type, uint16_t msg_id);
+
+bool emulatorClockIsVirtual(void);
+void emulatorClockAdvance(uint32_t millis);
+
 void emulatorSocketInit(void);
 size_t emulatorSocketRead(int *iface, void *buffer, size_t size);
 size_t emulatorSocketWrite(int iface, const void *buffer, size_t size);
@@ -18,10 +18,15 @@
  */
 
 #include <string.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <unistd.h>
 
 #include "memory.h"
+#include "timer.h"
+
+#define ENV_FLASH_ERASE_DELAY "TREZOR_FLASH_ERASE_DELAY"
 
 void flash_lock(void) {}
 void flash_unlock(void) {}
@@ -83,6 +88,35 @@ static ssize_t sector_to_size(uint8_t sector) {
 	return end - start;
 }
 
+/* Typical sector erase times of the STM32F205 with 32-bit parallelism */
+static uint32_t sector_erase_ms(ssize_t size) {
+	switch (size) {
+	case 0x4000:
+		return 250;
+	case 0x10000:
+		return 550;
+	default:
+		return 1000;
+	}
+}
+
+static void simulate_erase_time(ssize_t size) {
+	static int simulate = -1;
+	if (simulate < 0) {
+		const char *variable = getenv(ENV_FLASH_ERASE_DELAY);
+		simulate = variable && atoi(variable);
+	}
+	if (!simulate) {
+		return;
+	}
+	uint32_t millis = sector_erase_ms(size);
+	if (emulatorClockIsVirtual()) {
+		emulatorClockAdvance(millis);
+	} else {
+		usleep(millis * 1000);
+	}
+}
+
 void flash_erase_sector(uint8_t sector, uint32_t program_size) {
 	(void) program_size;
 
@@ -96,7 +130,11 @@ void flash_erase_sector(uint8_t sector, uint32_t program_size) {
 		return;
 	}
 
+	uint32_t start = timer_ms();
 	memset(address, 0xFF, size);
+	simulate_erase_time(size);
+	flash_stats.erase_count++;
+	flash_stats.erase_us += (timer_ms() - start) * 1000;
 }
 
 void flash_erase_all_sectors(uint32_t program_size) {
@@ -106,11 +144,26 @@ void flash_erase_all_sectors(uint32_t program_size) {
 }
 
 void flash_program_word(uint32_t address, uint32_t data) {
-	*(volatile uint32_t *)FLASH_PTR(address) = data;
+	// programming can only clear bits
+	*(volatile uint32_t *)FLASH_PTR(address) &= data;
+	flash_stats.program_count++;
 }
 
 void flash_program_byte(uint32_t address, uint8_t data) {
-	*(volatile uint8_t *)FLASH_PTR(address) = data;
+	*(volatile uint8_t *)FLASH_PTR(address) &= data;
+}
+
+uint32_t flash_program_words(uint32_t addr, const uint32_t *src, uint32_t nwords) {
+	assert (addr % sizeof(uint32_t) == 0);
+	assert (addr >= FLASH_ORIGIN && addr + nwords * sizeof(uint32_t) <= FLASH_ORIGIN + FLASH_TOTAL_SIZE);
+	const uint8_t *data = (const uint8_t *) src;
+	uint8_t *flash = (uint8_t *) FLASH_PTR(addr);
+	// programming can only clear bits
+	for (uint32_t i = 0; i < nwords * sizeof(uint32_t); i++) {
+		flash[i] &= data[i];
+	}
+	flash_stats.program_count += nwords;
+	return 0;
 }
 
 static bool flash_locked = true;
@@ -128,8 +181,37 @@ void svc_flash_erase_sector(uint16_t sector) {
 			sector <= FLASH_META_SECTOR_LAST);
 	flash_erase_sector(sector, 3);
 }
+uint32_t svc_flash_program_words(uint32_t addr, const uint32_t *src, uint32_t nwords) {
+	assert (!flash_locked);
+	assert (addr >= FLASH_META_START && addr + nwords * sizeof(uint32_t) <= FLASH_APP_START);
+	return flash_program_words(addr, src, nwords);
+}
 uint32_t svc_flash_lock(void) {
 	assert (!flash_locked);
 	flash_locked = true;
 	return 0;
 }
+
+static uint8_t *flash_snapshots[EMULATOR_SNAPSHOT_SLOTS];
+
+bool emulatorFlashSnapshot(uint32_t slot) {
+	if (slot >= EMULATOR_SNAPSHOT_SLOTS) {
+		return false;
+	}
+	if (flash_snapshots[slot] == NULL) {
+		flash_snapshots[slot] = malloc(FLASH_TOTAL_SIZE);
+		if (flash_snapshots[slot] == NULL) {
+			return false;
+		}
+	}
+	memcpy(flash_snapshots[slot], emulator_flash_base, FLASH_TOTAL_SIZE);
+	return true;
+}
+
+bool emulatorFlashRestore(uint32_t slot) {
+	if (slot >= EMULATOR_SNAPSHOT_SLOTS || flash_snapshots[slot] == NULL) {
+		return false;
+	}
+	memcpy(emulator_flash_base, flash_snapshots[slot], FLASH_TOTAL_SIZE);
+	return true;
+}
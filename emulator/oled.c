@@ -17,12 +17,150 @@
  * along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
 #include "oled.h"
 
+#define ENV_OLED_STATS "TREZOR_OLED_STATS"
+#define ENV_OLED_CAPTURE "TREZOR_OLED_CAPTURE"
+
+/* Mock SPI sink that counts the bytes oledRefresh would transmit to the
+ * display of the device: the column and page address commands and the
+ * changed data of every page.
+ */
+static uint32_t spi_refreshes = 0;
+static uint32_t spi_bytes = 0;
+
+static void emulatorSendPage(int page, int col, const uint8_t *data, int len) {
+	(void) page;
+	(void) col;
+	(void) data;
+	spi_bytes += 6 + len;
+}
+
+static bool oled_stats = false;
+
+static void emulatorOledStats(void) {
+	fprintf(stderr, "oled: %u refreshes, %u bytes sent\n", spi_refreshes, spi_bytes);
+}
+
+/* Frame capture: the file named by TREZOR_OLED_CAPTURE gets a header
+ * "TRZC", version 1, width and height, followed by records of a type
+ * byte, a little endian 64 bit monotonic time in microseconds and a 16
+ * bit message id:
+ *
+ *   'F'  refresh, the id of the last message, the shown buffer follows
+ *   'S'  refresh with the same buffer as the frame before
+ *   'M'  start of processing a message, 'D' for a debug link message
+ *
+ * emulator/oled_capture.py turns it into screen latencies.
+ */
+static FILE *capture = NULL;
+static uint16_t capture_msg_id = 0xFFFF;
+static uint8_t capture_last[OLED_BUFSIZE];
+static bool capture_last_valid = false;
+
+static void emulatorCaptureRecord(uint8_t type, uint16_t value, const uint8_t *data, size_t len) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	uint64_t usec = (uint64_t) t.tv_sec * 1000000 + t.tv_nsec / 1000;
+
+	uint8_t record[11];
+	record[0] = type;
+	for (int i = 0; i < 8; i++) {
+		record[1 + i] = usec >> (8 * i);
+	}
+	record[9] = value;
+	record[10] = value >> 8;
+	fwrite(record, 1, sizeof(record), capture);
+	if (len > 0) {
+		fwrite(data, 1, len, capture);
+	}
+	fflush(capture);
+}
+
+static void emulatorCaptureFrame(void) {
+	const uint8_t *buffer = oledGetBuffer();
+	if (capture_last_valid && memcmp(buffer, capture_last, OLED_BUFSIZE) == 0) {
+		emulatorCaptureRecord('S', capture_msg_id, NULL, 0);
+	} else {
+		emulatorCaptureRecord('F', capture_msg_id, buffer, OLED_BUFSIZE);
+		memcpy(capture_last, buffer, OLED_BUFSIZE);
+		capture_last_valid = true;
+	}
+}
+
+void emulatorCaptureMessage(char type, uint16_t msg_id) {
+	if (!capture) {
+		return;
+	}
+	if (type == 'n') {
+		capture_msg_id = msg_id;
+	}
+	emulatorCaptureRecord(type == 'n' ? 'M' : 'D', msg_id, NULL, 0);
+}
+
+static void emulatorCaptureClose(void) {
+	fclose(capture);
+	capture = NULL;
+}
+
+static void emulatorOledSetup(void) {
+	const char *variable = getenv(ENV_OLED_STATS);
+	if (variable && atoi(variable)) {
+		oled_stats = true;
+		atexit(emulatorOledStats);
+	}
+
+	variable = getenv(ENV_OLED_CAPTURE);
+	if (variable && *variable) {
+		capture = fopen(variable, "wb");
+		if (!capture) {
+			fprintf(stderr, "Failed to open %s: %s\n", variable, strerror(errno));
+			exit(1);
+		}
+		const uint8_t header[7] = {'T', 'R', 'Z', 'C', 1, OLED_WIDTH, OLED_HEIGHT};
+		fwrite(header, 1, sizeof(header), capture);
+		atexit(emulatorCaptureClose);
+	}
+}
+
+/* Returns the refreshes so far and the bytes they would have transmitted.
+ * Without a display the bytes are only counted after the first call or
+ * with TREZOR_OLED_STATS set.
+ */
+void emulatorOledCounters(uint32_t *refreshes, uint32_t *bytes) {
+	oled_stats = true;
+	*refreshes = spi_refreshes;
+	*bytes = spi_bytes;
+}
+
 #if HEADLESS
 
-void oledInit(void) {}
-void oledRefresh(void) {}
+void oledInit(void) {
+	emulatorOledSetup();
+}
+
+/* Without a display a refresh only counts, unless the statistics of the
+ * transmitted bytes or the frame capture were requested.
+ */
+void oledRefresh(void) {
+	spi_refreshes++;
+	if (oled_stats || capture) {
+		oledInvertDebugLink();
+		if (oled_stats) {
+			oledRefreshPages(emulatorSendPage);
+		}
+		if (capture) {
+			emulatorCaptureFrame();
+		}
+		oledInvertDebugLink();
+	}
+}
+
 void emulatorPoll(void) {}
 
 #else
@@ -32,6 +170,56 @@ void emulatorPoll(void) {}
 static SDL_Renderer *renderer = NULL;
 static SDL_Texture *texture = NULL;
 
+/* Frames are presented at most once per OLED_FRAME_MS, a pending frame
+ * is presented by a later refresh or by emulatorPoll.
+ */
+#define OLED_FRAME_MS 16
+
+static uint32_t pixels[OLED_HEIGHT][OLED_WIDTH];
+static uint32_t pixels_lut[256][8];
+static bool pixels_pending = false;
+static uint32_t pixels_presented = 0;
+
+static void emulatorPixelsSetup(void) {
+	for (int i = 0; i < 256; i++) {
+		for (int k = 0; k < 8; k++) {
+			pixels_lut[i][k] = (i & (0x80 >> k)) ? 0xFFFFFFFF : 0xFF000000;
+		}
+	}
+}
+
+/* Expands the changed bytes of a page into pixels, the buffer stores the
+ * display rotated by 180 degrees.
+ */
+static void emulatorExpandPage(int page, int col, const uint8_t *data, int len) {
+	emulatorSendPage(page, col, data, len);
+
+	int y = (OLED_HEIGHT / 8 - 1 - page) * 8;
+	for (int i = 0; i < len; i++) {
+		int x = OLED_WIDTH - 1 - (col + i);
+		const uint32_t *column = pixels_lut[data[i]];
+		for (int k = 0; k < 8; k++) {
+			pixels[y + k][x] = column[k];
+		}
+	}
+	pixels_pending = true;
+}
+
+static void emulatorPresent(void) {
+	if (!pixels_pending) {
+		return;
+	}
+	uint32_t now = SDL_GetTicks();
+	if (pixels_presented && now - pixels_presented < OLED_FRAME_MS) {
+		return;
+	}
+	SDL_UpdateTexture(texture, NULL, pixels, OLED_WIDTH * sizeof(uint32_t));
+	SDL_RenderCopy(renderer, texture, NULL, NULL);
+	SDL_RenderPresent(renderer);
+	pixels_presented = now ? now : 1;
+	pixels_pending = false;
+}
+
 #define ENV_OLED_SCALE "TREZOR_OLED_SCALE"
 
 static int emulatorScale(void) {
@@ -47,6 +235,9 @@ static int emulatorScale(void) {
 }
 
 void oledInit(void) {
+	emulatorOledSetup();
+	emulatorPixelsSetup();
+
 	if (SDL_Init(SDL_INIT_VIDEO) != 0) {
 		fprintf(stderr, "Failed to initialize SDL: %s\n", SDL_GetError());
 		exit(1);
@@ -82,35 +273,30 @@ void oledInit(void) {
 	oledRefresh();
 }
 
+/* Only the bytes that changed since the last refresh are expanded,
+ * unchanged frames are not uploaded at all.
+ */
 void oledRefresh(void) {
 	/* Draw triangle in upper right corner */
 	oledInvertDebugLink();
 
-	const uint8_t *buffer = oledGetBuffer();
-
-	static uint32_t data[OLED_HEIGHT][OLED_WIDTH];
-
-	for (size_t i = 0; i < OLED_BUFSIZE; i++) {
-		int x = (OLED_BUFSIZE - 1 - i) % OLED_WIDTH;
-		int y = (OLED_BUFSIZE - 1 - i) / OLED_WIDTH * 8 + 7;
-
-		for (uint8_t shift = 0; shift < 8; shift++, y--) {
-			bool set = (buffer[i] >> shift) & 1;
-			data[y][x] = set ? 0xFFFFFFFF : 0xFF000000;
-		}
+	spi_refreshes++;
+	oledRefreshPages(emulatorExpandPage);
+	if (capture) {
+		emulatorCaptureFrame();
 	}
 
-	SDL_UpdateTexture(texture, NULL, data, OLED_WIDTH * sizeof(uint32_t));
-	SDL_RenderCopy(renderer, texture, NULL, NULL);
-	SDL_RenderPresent(renderer);
-
 	/* Return it back */
 	oledInvertDebugLink();
+
+	emulatorPresent();
 }
 
 void emulatorPoll(void) {
 	SDL_Event event;
 
+	emulatorPresent();
+
 	if (SDL_PollEvent(&event)) {
 		if (event.type == SDL_QUIT) {
 			exit(1);
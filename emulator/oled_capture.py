@@ -0,0 +1,176 @@
+#!/usr/bin/env python
+# Analyses a frame capture written by the emulator with
+# TREZOR_OLED_CAPTURE=<file>: lists the screens with the latency from the
+# message that led to them and the number of refreshes, summarises the
+# latencies per message id and optionally writes the screens as PNG.
+from __future__ import print_function
+
+import argparse
+import collections
+import json
+import os
+import struct
+import sys
+import zlib
+
+HEADER = b'TRZC'
+RECORD = struct.Struct('<cQH')
+
+Frame = collections.namedtuple('Frame', 'time msg_id data')
+Message = collections.namedtuple('Message', 'time msg_id debug')
+
+
+def parse(fn):
+    with open(fn, 'rb') as f:
+        blob = f.read()
+    if blob[:4] != HEADER or blob[4:5] != b'\x01':
+        raise ValueError('%s is not a frame capture' % fn)
+    width, height = bytearray(blob[5:7])
+    size = width * height // 8
+    records = []
+    data = None
+    pos = 7
+    while pos + RECORD.size <= len(blob):
+        kind, time, value = RECORD.unpack_from(blob, pos)
+        pos += RECORD.size
+        if kind == b'F':
+            if pos + size > len(blob):
+                break
+            data = bytearray(blob[pos:pos + size])
+            pos += size
+            records.append(Frame(time, value, data))
+        elif kind == b'S':
+            records.append(Frame(time, value, data))
+        elif kind in (b'M', b'D'):
+            records.append(Message(time, value, kind == b'D'))
+        else:
+            raise ValueError('unknown record %r at offset %d' % (kind, pos - RECORD.size))
+    return width, height, records
+
+
+def screens(records):
+    # consecutive refreshes with the same contents form one screen
+    result = []
+    message = None
+    for record in records:
+        if isinstance(record, Message):
+            if not record.debug:
+                message = record
+            continue
+        if result and result[-1]['data'] is record.data:
+            result[-1]['refreshes'] += 1
+            result[-1]['end'] = record.time
+            continue
+        result.append({
+            'index': len(result),
+            'time': record.time,
+            'end': record.time,
+            'msg_id': message.msg_id if message else None,
+            'latency': record.time - message.time if message else None,
+            'first': message is not None and (not result or result[-1]['message'] is not message),
+            'message': message,
+            'refreshes': 1,
+            'data': record.data,
+        })
+    return result
+
+
+def summary(records, screen_list):
+    per_msg = collections.OrderedDict()
+    for record in records:
+        if isinstance(record, Message) and not record.debug:
+            per_msg.setdefault(record.msg_id, {'messages': 0, 'screens': 0, 'refreshes': 0, 'latencies': []})
+            per_msg[record.msg_id]['messages'] += 1
+    for screen in screen_list:
+        if screen['msg_id'] is None:
+            continue
+        stats = per_msg[screen['msg_id']]
+        stats['screens'] += 1
+        stats['refreshes'] += screen['refreshes']
+        if screen['first']:
+            stats['latencies'].append(screen['latency'])
+    result = []
+    for msg_id, stats in per_msg.items():
+        latencies = stats.pop('latencies')
+        stats['msg_id'] = msg_id
+        if latencies:
+            stats['first_screen_ms'] = {
+                'min': min(latencies) / 1000.0,
+                'avg': sum(latencies) / 1000.0 / len(latencies),
+                'max': max(latencies) / 1000.0,
+            }
+        result.append(stats)
+    return result
+
+
+def write_png(fn, width, height, data):
+    rows = []
+    for y in range(height):
+        row = bytearray(b'\x00')
+        for x in range(width):
+            offset = width * height // 8 - 1 - x - (y // 8) * width
+            row.append(255 if data[offset] & (1 << (7 - y % 8)) else 0)
+        rows.append(bytes(row))
+
+    def chunk(kind, payload):
+        crc = zlib.crc32(kind + payload) & 0xffffffff
+        return struct.pack('>I', len(payload)) + kind + payload + struct.pack('>I', crc)
+
+    with open(fn, 'wb') as f:
+        f.write(b'\x89PNG\r\n\x1a\n')
+        f.write(chunk(b'IHDR', struct.pack('>IIBBBBB', width, height, 8, 0, 0, 0, 0)))
+        f.write(chunk(b'IDAT', zlib.compress(b''.join(rows))))
+        f.write(chunk(b'IEND', b''))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Analyse an emulator frame capture.')
+    parser.add_argument('capture', help='file written with TREZOR_OLED_CAPTURE')
+    parser.add_argument('--json', action='store_true', help='print the screens and summary as JSON')
+    parser.add_argument('--png', metavar='DIR', help='write every screen as DIR/screen-NNNN.png')
+    args = parser.parse_args()
+
+    width, height, records = parse(args.capture)
+    screen_list = screens(records)
+    stats = summary(records, screen_list)
+    start = records[0].time if records else 0
+
+    if args.png:
+        if not os.path.isdir(args.png):
+            os.makedirs(args.png)
+        for screen in screen_list:
+            write_png(os.path.join(args.png, 'screen-%04d.png' % screen['index']), width, height, screen['data'])
+
+    if args.json:
+        json.dump({
+            'screens': [{
+                'index': s['index'],
+                'time_ms': (s['time'] - start) / 1000.0,
+                'duration_ms': (s['end'] - s['time']) / 1000.0,
+                'msg_id': s['msg_id'],
+                'latency_ms': s['latency'] / 1000.0 if s['latency'] is not None else None,
+                'refreshes': s['refreshes'],
+            } for s in screen_list],
+            'messages': stats,
+        }, sys.stdout, indent=2)
+        print()
+        return
+
+    print('%6s %10s %10s %6s %10s %9s' % ('screen', 'time ms', 'shown ms', 'msg', 'latency ms', 'refreshes'))
+    for s in screen_list:
+        print('%6d %10.1f %10.1f %6s %10s %9d' % (
+            s['index'], (s['time'] - start) / 1000.0, (s['end'] - s['time']) / 1000.0,
+            '-' if s['msg_id'] is None else s['msg_id'],
+            '-' if s['latency'] is None else '%.1f' % (s['latency'] / 1000.0),
+            s['refreshes']))
+    print()
+    print('%6s %8s %8s %9s %28s' % ('msg', 'count', 'screens', 'refreshes', 'first screen ms min/avg/max'))
+    for m in stats:
+        latency = m.get('first_screen_ms')
+        print('%6d %8d %8d %9d %28s' % (
+            m['msg_id'], m['messages'], m['screens'], m['refreshes'],
+            '%.1f/%.1f/%.1f' % (latency['min'], latency['avg'], latency['max']) if latency else '-'))
+
+
+if __name__ == '__main__':
+    main()
@@ -34,6 +34,8 @@
 
 #define EMULATOR_FLASH_FILE "emulator.img"
 
+#define ENV_FLASH_MEMORY "TREZOR_FLASH_MEMORY"
+
 uint8_t *emulator_flash_base = NULL;
 
 uint32_t __stack_chk_guard;
@@ -69,6 +71,18 @@ static void setup_urandom(void) {
 }
 
 static void setup_flash(void) {
+	const char *memory = getenv(ENV_FLASH_MEMORY);
+	if (memory && atoi(memory)) {
+		/* Keep the flash in memory only, it starts erased */
+		emulator_flash_base = mmap(NULL, FLASH_TOTAL_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (emulator_flash_base == MAP_FAILED) {
+			perror("Failed to map flash emulation memory");
+			exit(1);
+		}
+		flash_erase_all_sectors(FLASH_CR_PROGRAM_X32);
+		return;
+	}
+
 	int fd = open(EMULATOR_FLASH_FILE, O_RDWR | O_SYNC | O_CREAT, 0644);
 	if (fd < 0) {
 		perror("Failed to open flash emulation file");
@@ -17,16 +17,37 @@
  * along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdlib.h>
 #include <time.h>
 
 #include "timer.h"
 
-void timer_init(void) {}
+#define ENV_VIRTUAL_CLOCK "TREZOR_VIRTUAL_CLOCK"
+
+static bool virtual_clock = false;
+static uint32_t virtual_ms = 0;
+
+void timer_init(void) {
+	const char *variable = getenv(ENV_VIRTUAL_CLOCK);
+	virtual_clock = variable && atoi(variable);
+}
 
 uint32_t timer_ms(void) {
+	if (virtual_clock) {
+		return virtual_ms;
+	}
+
 	struct timespec t;
 	clock_gettime(CLOCK_MONOTONIC, &t);
 
         uint32_t msec = t.tv_sec * 1000 + (t.tv_nsec / 1000000);
 	return msec;
 }
+
+bool emulatorClockIsVirtual(void) {
+	return virtual_clock;
+}
+
+void emulatorClockAdvance(uint32_t millis) {
+	virtual_ms += millis;
+}
@@ -0,0 +1,53 @@
+/*
+ * This file is part of the TREZOR project, https://trezor.io/
+ *
+ * Copyright (C) 2018 SatoshiLabs
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+
+#include "arena.h"
+#include "memzero.h"
+
+#define ARENA_ALIGN 8
+
+static CONFIDENTIAL uint8_t arena[ARENA_SIZE] __attribute__((aligned(ARENA_ALIGN)));
+static size_t arena_top = 0;
+
+void *arena_alloc(size_t size)
+{
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	if (size > ARENA_SIZE - arena_top) {
+		return NULL;
+	}
+	void *ptr = arena + arena_top;
+	arena_top += size;
+	return ptr;
+}
+
+void arena_release(const void *ptr)
+{
+	if (ptr == NULL) {
+		return;
+	}
+	size_t offset = (const uint8_t *)ptr - arena;
+	if (offset >= arena_top) {
+		return;
+	}
+	memzero(arena + offset, arena_top - offset);
+	arena_top = offset;
+}
@@ -0,0 +1,39 @@
+/*
+ * This file is part of the TREZOR project, https://trezor.io/
+ *
+ * Copyright (C) 2018 SatoshiLabs
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "messages.h"
+
+/* Memory for the buffers that are only live while a single request is
+ * received and processed: the raw and the decoded message, the response
+ * and the U2F read buffer.  Allocations are released in reverse order,
+ * releasing an allocation also releases everything allocated after it.
+ * Released memory is wiped.
+ */
+#define ARENA_SIZE (MSG_DATA_SIZE + (MSG_IN_SIZE + MSG_IN_PADDING > MSG_OUT_SIZE ? MSG_IN_SIZE + MSG_IN_PADDING : MSG_OUT_SIZE))
+
+void *arena_alloc(size_t size);
+void arena_release(const void *ptr);
+
+#endif
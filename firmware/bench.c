@@ -0,0 +1,190 @@
+/*
+ * This file is part of the TREZOR project, https://trezor.io/
+ *
+ * Copyright (C) 2018 SatoshiLabs
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Micro-benchmark of the display drawing code on the host, built with
+ * "make bench EMULATOR=1 HEADLESS=1".  Refreshes go to the mock SPI sink
+ * of the emulator, which counts the bytes the device would transmit.
+ * Every benchmark prints one JSON line:
+ *
+ *   {"name": ..., "ops": ..., "ops_per_sec": ..., "refreshes_per_op": ..., "bytes_per_op": ...}
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trezor.h"
+#include "oled.h"
+#include "layout.h"
+#include "layout2.h"
+#include "bitmaps.h"
+
+#if !HEADLESS
+#error "the display benchmark needs HEADLESS=1"
+#endif
+
+#define BENCH_SECONDS 0.5
+
+/* Screen timeout, defined by trezor.c in the firmware */
+uint32_t system_millis_lock_start;
+
+static const char *address1 = "1BoatSLRHtKNngkdXEeobR76b53LETtpyT";
+static const char *address2 = "3J98t1WpEZ73CNmQviecrnyiWrnqRhWNLy";
+static const uint32_t address_n[5] = {0x80000000 + 44, 0x80000000, 0x80000000, 0, 7};
+
+static void benchClear(void)
+{
+	oledClear();
+	oledRefresh();
+}
+
+static void benchDrawString(uint32_t i)
+{
+	oledBox(0, 0, OLED_WIDTH - 1, 7, false);
+	oledDrawString(i % 32, 0, "The quick brown fox", FONT_STANDARD);
+	oledRefresh();
+}
+
+static void benchDrawStringDouble(uint32_t i)
+{
+	oledBox(0, 0, OLED_WIDTH - 1, 15, false);
+	oledDrawString(i % 32, 0, "Quick fox", FONT_STANDARD | FONT_DOUBLE);
+	oledRefresh();
+}
+
+static void benchDrawBitmap(uint32_t i)
+{
+	static const BITMAP *gears[4] = {&bmp_gears0, &bmp_gears1, &bmp_gears2, &bmp_gears3};
+	oledDrawBitmap(40, 0, gears[i % 4]);
+	oledRefresh();
+}
+
+static void benchDrawBitmapUnaligned(uint32_t i)
+{
+	static const BITMAP *gears[4] = {&bmp_gears0, &bmp_gears1, &bmp_gears2, &bmp_gears3};
+	oledDrawBitmap(40, 3, gears[i % 4]);
+	oledRefresh();
+}
+
+static void benchInvert(uint32_t i)
+{
+	(void)i;
+	oledInvert(0, 0, OLED_WIDTH - 1, OLED_HEIGHT - 1);
+	oledRefresh();
+}
+
+static void benchSwipeLeft(uint32_t i)
+{
+	oledDrawString(0, 0, i % 2 ? "Swipe" : "Left", FONT_STANDARD | FONT_DOUBLE);
+	oledSwipeLeft();
+}
+
+static void benchDialog(uint32_t i)
+{
+	layoutDialog(&bmp_icon_question, "Cancel", "Confirm", NULL,
+		"Do you really want to", i % 2 ? "send 0.1 BTC" : "send 0.2 BTC", "to", address1, NULL, NULL);
+}
+
+static void benchAddressText(uint32_t i)
+{
+	layoutAddress(i % 2 ? address1 : address2, "Address:", false, false, address_n, 5);
+}
+
+static void benchAddressToggle(uint32_t i)
+{
+	layoutAddress(address1, "Address:", i % 2, false, address_n, 5);
+}
+
+static void benchAddressQR(uint32_t i)
+{
+	layoutAddress(i % 2 ? address1 : address2, "Address:", true, false, address_n, 5);
+}
+
+static void benchProgress(uint32_t i)
+{
+	layoutProgress("Signing transaction", i % 1000);
+}
+
+static const struct {
+	const char *name;
+	void (*run)(uint32_t i);
+} benchmarks[] = {
+	{"oledDrawString", benchDrawString},
+	{"oledDrawString_double", benchDrawStringDouble},
+	{"oledDrawBitmap", benchDrawBitmap},
+	{"oledDrawBitmap_unaligned", benchDrawBitmapUnaligned},
+	{"oledInvert", benchInvert},
+	{"oledSwipeLeft", benchSwipeLeft},
+	{"layoutDialog", benchDialog},
+	{"layoutAddress_text", benchAddressText},
+	{"layoutAddress_toggle", benchAddressToggle},
+	{"layoutAddress_qr", benchAddressQR},
+	{"layoutProgress", benchProgress},
+};
+
+static double benchNow(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv)
+{
+	oledInit();
+
+	// start counting the transmitted bytes
+	uint32_t refreshes_start, bytes_start, refreshes_end, bytes_end;
+	emulatorOledCounters(&refreshes_start, &bytes_start);
+
+	for (size_t b = 0; b < sizeof(benchmarks) / sizeof(benchmarks[0]); b++) {
+		// only run the benchmarks named on the command line
+		if (argc > 1) {
+			bool found = false;
+			for (int a = 1; a < argc; a++) {
+				found = found || strcmp(argv[a], benchmarks[b].name) == 0;
+			}
+			if (!found) {
+				continue;
+			}
+		}
+
+		benchClear();
+		benchmarks[b].run(0);
+
+		emulatorOledCounters(&refreshes_start, &bytes_start);
+		double start = benchNow(), elapsed;
+		uint32_t ops = 0;
+		do {
+			for (int k = 0; k < 16; k++) {
+				benchmarks[b].run(++ops);
+			}
+			elapsed = benchNow() - start;
+		} while (elapsed < BENCH_SECONDS);
+		emulatorOledCounters(&refreshes_end, &bytes_end);
+
+		printf("{\"name\": \"%s\", \"ops\": %u, \"ops_per_sec\": %.1f, \"refreshes_per_op\": %.2f, \"bytes_per_op\": %.1f}\n",
+			benchmarks[b].name, ops, ops / elapsed,
+			(double)(refreshes_end - refreshes_start) / ops,
+			(double)(bytes_end - bytes_start) / ops);
+	}
+
+	return 0;
+}
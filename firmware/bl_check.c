@@ -70,12 +70,14 @@ void check_bootloader(void)
 	for (int i = FLASH_BOOT_SECTOR_FIRST; i <= FLASH_BOOT_SECTOR_LAST; i++) {
 		flash_erase_sector(i, FLASH_CR_PROGRAM_X32);
 	}
-	for (int i = 0; i < FLASH_BOOT_LEN / 4; i++) {
-		const uint32_t *w = (const uint32_t *)(bl_data + i * 4);
-		flash_program_word(FLASH_BOOT_START + i * 4, *w);
-	}
+	uint32_t status = flash_program_words(FLASH_BOOT_START, (const uint32_t *)bl_data, FLASH_BOOT_LEN / 4);
 	flash_lock();
 
+	if (status & (FLASH_SR_PGAERR | FLASH_SR_PGPERR | FLASH_SR_PGSERR | FLASH_SR_WRPERR)) {
+		layoutDialog(&bmp_icon_error, NULL, NULL, NULL, "Bootloader update", "failed.", NULL, "Unplug your TREZOR", "contact our support.", NULL);
+		shutdown();
+	}
+
 	// show info and halt
 	layoutDialog(&bmp_icon_info, NULL, NULL, NULL, _("Update finished"), _("successfully."), NULL, _("Please reconnect"), _("the device."), NULL);
 	shutdown();
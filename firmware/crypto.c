@@ -111,22 +111,22 @@ int gpgMessageSign(HDNode *node, const uint8_t *message, size_t message_len, uin
 	}
 }
 
+void cryptoMessageHashInit(const CoinInfo *coin, uint32_t message_len, Hasher *hasher)
+{
+	hasher_Init(hasher, coin->curve->hasher_sign);
+	hasher_Update(hasher, (const uint8_t *)coin->signed_message_header, strlen(coin->signed_message_header));
+	ser_length_hash(hasher, message_len);
+}
+
 static void cryptoMessageHash(const CoinInfo *coin, const uint8_t *message, size_t message_len, uint8_t hash[HASHER_DIGEST_LENGTH]) {
 	Hasher hasher;
-	hasher_Init(&hasher, coin->curve->hasher_sign);
-	hasher_Update(&hasher, (const uint8_t *)coin->signed_message_header, strlen(coin->signed_message_header));
-	uint8_t varint[5];
-	uint32_t l = ser_length(message_len, varint);
-	hasher_Update(&hasher, varint, l);
+	cryptoMessageHashInit(coin, message_len, &hasher);
 	hasher_Update(&hasher, message, message_len);
 	hasher_Final(&hasher, hash);
 }
 
-int cryptoMessageSign(const CoinInfo *coin, HDNode *node, InputScriptType script_type, const uint8_t *message, size_t message_len, uint8_t *signature)
+int cryptoMessageSignDigest(HDNode *node, InputScriptType script_type, const uint8_t hash[HASHER_DIGEST_LENGTH], uint8_t *signature)
 {
-	uint8_t hash[HASHER_DIGEST_LENGTH];
-	cryptoMessageHash(coin, message, message_len, hash);
-
 	uint8_t pby;
 	int result = hdnode_sign_digest(node, hash, signature + 1, &pby, NULL);
 	if (result == 0) {
@@ -148,16 +148,27 @@ int cryptoMessageSign(const CoinInfo *coin, HDNode *node, InputScriptType script
 	return result;
 }
 
+int cryptoMessageSign(const CoinInfo *coin, HDNode *node, InputScriptType script_type, const uint8_t *message, size_t message_len, uint8_t *signature)
+{
+	uint8_t hash[HASHER_DIGEST_LENGTH];
+	cryptoMessageHash(coin, message, message_len, hash);
+	return cryptoMessageSignDigest(node, script_type, hash, signature);
+}
+
 int cryptoMessageVerify(const CoinInfo *coin, const uint8_t *message, size_t message_len, const char *address, const uint8_t *signature)
+{
+	uint8_t hash[HASHER_DIGEST_LENGTH];
+	cryptoMessageHash(coin, message, message_len, hash);
+	return cryptoMessageVerifyDigest(coin, hash, address, signature);
+}
+
+int cryptoMessageVerifyDigest(const CoinInfo *coin, const uint8_t hash[HASHER_DIGEST_LENGTH], const char *address, const uint8_t *signature)
 {
 	// check for invalid signature prefix
 	if (signature[0] < 27 || signature[0] > 43) {
 		return 1;
 	}
 
-	uint8_t hash[HASHER_DIGEST_LENGTH];
-	cryptoMessageHash(coin, message, message_len, hash);
-
 	uint8_t recid = (signature[0] - 27) % 4;
 	bool compressed = signature[0] >= 31;
 
@@ -41,8 +41,18 @@ int sshMessageSign(HDNode *node, const uint8_t *message, size_t message_len, uin
 
 int gpgMessageSign(HDNode *node, const uint8_t *message, size_t message_len, uint8_t *signature);
 
+/* Start hashing a signed message of the given length.  The message
+ * itself can then be fed in pieces with hasher_Update and the digest
+ * passed to cryptoMessageSignDigest or cryptoMessageVerifyDigest.
+ */
+void cryptoMessageHashInit(const CoinInfo *coin, uint32_t message_len, Hasher *hasher);
+
+int cryptoMessageSignDigest(HDNode *node, InputScriptType script_type, const uint8_t hash[HASHER_DIGEST_LENGTH], uint8_t *signature);
+
 int cryptoMessageSign(const CoinInfo *coin, HDNode *node, InputScriptType script_type, const uint8_t *message, size_t message_len, uint8_t *signature);
 
+int cryptoMessageVerifyDigest(const CoinInfo *coin, const uint8_t hash[HASHER_DIGEST_LENGTH], const char *address, const uint8_t *signature);
+
 int cryptoMessageVerify(const CoinInfo *coin, const uint8_t *message, size_t message_len, const char *address, const uint8_t *signature);
 
 /* ECIES disabled
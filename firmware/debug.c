@@ -17,6 +17,8 @@
  * along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+
 #include "trezor.h"
 #include "debug.h"
 #include "oled.h"
@@ -66,3 +68,85 @@ char *debugInt(const uint32_t i)
 }
 
 #endif
+
+#if DEBUG_LINK
+
+/*
+ * The display buffer as the debug link client knows it and the sequence
+ * number of that state.  Sequence number 0 means the client knows nothing.
+ */
+static uint8_t screen_known[OLED_BUFSIZE];
+static uint32_t screen_seq = 0;
+
+/*
+ * Writes the changes of the display buffer since the state seq to out:
+ *
+ *   uint32_t seq      sequence number of the state after applying this
+ *   uint16_t ranges   number of ranges that follow
+ *   uint16_t pending  changed bytes that did not fit into size
+ *   ranges times:
+ *     uint16_t offset, uint16_t length, length bytes of the buffer
+ *
+ * Returns the number of bytes written.  If seq is not the last state
+ * handed out, the whole buffer is sent.  Changes that do not fit are sent
+ * by the next call.
+ */
+uint32_t debugScreenDelta(uint32_t seq, uint8_t *out, uint32_t size)
+{
+	const uint8_t *screen = oledGetBuffer();
+	uint32_t pos = 8;
+	uint16_t ranges = 0, pending = 0;
+
+	if (size < pos) {
+		return 0;
+	}
+	if (seq == 0 || seq != screen_seq) {
+		// make every byte differ
+		for (int i = 0; i < OLED_BUFSIZE; i++) {
+			screen_known[i] = ~screen[i];
+		}
+	}
+
+	for (int i = 0; i < OLED_BUFSIZE; ) {
+		if (screen[i] == screen_known[i]) {
+			i++;
+			continue;
+		}
+		// merge changes closer than the size of a range header
+		int last = i;
+		for (int j = i + 1; j < OLED_BUFSIZE && j - last <= 4; j++) {
+			if (screen[j] != screen_known[j]) {
+				last = j;
+			}
+		}
+		uint16_t len = last - i + 1;
+		uint16_t n = size > pos + 4 ? size - pos - 4 : 0;
+		if (n > len) {
+			n = len;
+		}
+		if (n > 0) {
+			uint16_t offset = i;
+			memcpy(out + pos, &offset, 2);
+			memcpy(out + pos + 2, &n, 2);
+			memcpy(out + pos + 4, screen + i, n);
+			memcpy(screen_known + i, screen + i, n);
+			pos += 4 + n;
+			ranges++;
+		}
+		pending += len - n;
+		i = last + 1;
+	}
+
+	if (ranges > 0) {
+		screen_seq = (screen_seq + 1) & DEBUG_SCREEN_SEQ_MASK;
+		if (screen_seq == 0) {
+			screen_seq = 1;
+		}
+	}
+	memcpy(out, &screen_seq, 4);
+	memcpy(out + 4, &ranges, 2);
+	memcpy(out + 6, &pending, 2);
+	return pos;
+}
+
+#endif
@@ -35,4 +35,16 @@ char *debugInt(const uint32_t i);
 
 #endif
 
+#if DEBUG_LINK
+
+// pseudo addresses of DebugLinkMemoryRead
+#define DEBUG_MEMORY_SCREEN        0xF0000000 // the display buffer
+#define DEBUG_MEMORY_SCREEN_DELTA  0xF1000000 // + sequence number known to the client
+#define DEBUG_SCREEN_SEQ_MASK      0x00FFFFFF
+#define DEBUG_MEMORY_FLASH_STATS   0xF2000000 // the FlashStats counters
+
+uint32_t debugScreenDelta(uint32_t seq, uint8_t *out, uint32_t size);
+
+#endif
+
 #endif
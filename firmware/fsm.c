@@ -60,11 +60,9 @@
 
 // message methods
 
-static uint8_t msg_resp[MSG_OUT_SIZE] __attribute__ ((aligned));
-
 #define RESP_INIT(TYPE) \
 			TYPE *resp = (TYPE *) (void *) msg_resp; \
-			_Static_assert(sizeof(msg_resp) >= sizeof(TYPE), #TYPE " is too large"); \
+			_Static_assert(MSG_OUT_SIZE >= sizeof(TYPE), #TYPE " is too large"); \
 			memset(resp, 0, sizeof(TYPE));
 
 #define CHECK_INITIALIZED \
@@ -98,9 +96,13 @@ static uint8_t msg_resp[MSG_OUT_SIZE] __attribute__ ((aligned));
 		return; \
 	}
 
+// Success and Failure are also sent outside of message processing,
+// so they do not use RESP_INIT
 void fsm_sendSuccess(const char *text)
 {
-	RESP_INIT(Success);
+	Success success;
+	Success *resp = &success;
+	memset(resp, 0, sizeof(Success));
 	if (text) {
 		resp->has_message = true;
 		strlcpy(resp->message, text, sizeof(resp->message));
@@ -119,7 +121,9 @@ void fsm_sendFailure(FailureType code, const char *text)
 		protectAbortedByInitialize = false;
 		return;
 	}
-	RESP_INIT(Failure);
+	Failure failure;
+	Failure *resp = &failure;
+	memset(resp, 0, sizeof(Failure));
 	resp->has_code = true;
 	resp->code = code;
 	if (!text) {
@@ -218,6 +222,79 @@ static HDNode *fsm_getDerivedNode(const char *curve, const uint32_t *address_n,
 	return &node;
 }
 
+/* Like fsm_getDerivedNode, but with the public key filled in.  The
+ * public key is kept in the session cache, so that repeated requests
+ * for the same path skip computing it.  Used for SSH/GPG identities,
+ * whose path is determined by the identity fingerprint.
+ */
+static HDNode *fsm_getDerivedNodeCached(const char *curve, const uint32_t *address_n, size_t address_n_count)
+{
+	HDNode *node = fsm_getDerivedNode(curve, address_n, address_n_count, NULL);
+	if (!node) {
+		return 0;
+	}
+	if (!session_getPublicKey(curve, address_n, address_n_count, node->public_key)) {
+		hdnode_fill_public_key(node);
+		session_cachePublicKey(curve, address_n, address_n_count, node->public_key);
+	}
+	return node;
+}
+
+/* Derive a public node.  If the public node cache in storage is
+ * enabled and the path starts with a standard secp256k1 account path
+ * followed only by non-hardened components, the account node is looked
+ * up in (or added to) the cache and the remaining components are
+ * derived publicly.
+ */
+static HDNode *fsm_getDerivedPublicNode(const char *curve, const uint32_t *address_n, size_t address_n_count, uint32_t *fingerprint)
+{
+	static HDNode node;
+	size_t hardened = 0;
+	while (hardened < address_n_count && (address_n[hardened] & 0x80000000)) {
+		hardened++;
+	}
+	bool cacheable = strcmp(curve, SECP256K1_NAME) == 0 && storage_isPublicNodeCacheable(address_n, hardened);
+	for (size_t i = hardened; i < address_n_count; i++) {
+		if (address_n[i] & 0x80000000) {
+			cacheable = false;
+		}
+	}
+	if (!cacheable) {
+		HDNode *privnode = fsm_getDerivedNode(curve, address_n, address_n_count, fingerprint);
+		if (privnode) {
+			hdnode_fill_public_key(privnode);
+		}
+		return privnode;
+	}
+
+	uint32_t fp = 0;
+	if (!storage_getPublicNode(address_n, hardened, &node, &fp)) {
+		HDNode *privnode = fsm_getDerivedNode(curve, address_n, hardened, &fp);
+		if (!privnode) {
+			return 0;
+		}
+		hdnode_fill_public_key(privnode);
+		if (hdnode_from_xpub(privnode->depth, privnode->child_num, privnode->chain_code, privnode->public_key, curve, &node) != 1) {
+			fsm_sendFailure(FailureType_Failure_ProcessError, _("Failed to derive public key"));
+			layoutHome();
+			return 0;
+		}
+		storage_setPublicNode(address_n, hardened, &node, fp);
+	}
+	for (size_t i = hardened; i < address_n_count; i++) {
+		fp = hdnode_fingerprint(&node);
+		if (hdnode_public_ckd(&node, address_n[i]) == 0) {
+			fsm_sendFailure(FailureType_Failure_ProcessError, _("Failed to derive public key"));
+			layoutHome();
+			return 0;
+		}
+	}
+	if (fingerprint) {
+		*fingerprint = fp;
+	}
+	return &node;
+}
+
 static bool fsm_layoutAddress(const char *address, const char *desc, bool ignorecase, size_t prefixlen, const uint32_t *address_n, size_t address_n_count)
 {
 	bool qrcode = false;
@@ -22,6 +22,8 @@
 
 #include "messages.pb.h"
 
+void fsm_initFeatures(void);
+
 // message functions
 
 void fsm_sendSuccess(const char *text);
@@ -14,9 +14,8 @@ void fsm_msgGetPublicKey(GetPublicKey *msg)
 		curve = msg->ecdsa_curve_name;
 	}
 	uint32_t fingerprint;
-	HDNode *node = node = fsm_getDerivedNode(curve, msg->address_n, msg->address_n_count, &fingerprint);
+	HDNode *node = fsm_getDerivedPublicNode(curve, msg->address_n, msg->address_n_count, &fingerprint);
 	if (!node) return;
-	hdnode_fill_public_key(node);
 
 	if (msg->has_show_display && msg->show_display) {
 		layoutPublicKey(node->public_key);
@@ -156,9 +155,8 @@ void fsm_msgGetAddress(GetAddress *msg)
 
 	const CoinInfo *coin = fsm_getCoin(msg->has_coin_name, msg->coin_name);
 	if (!coin) return;
-	HDNode *node = fsm_getDerivedNode(coin->curve_name, msg->address_n, msg->address_n_count, NULL);
+	HDNode *node = fsm_getDerivedPublicNode(coin->curve_name, msg->address_n, msg->address_n_count, NULL);
 	if (!node) return;
-	hdnode_fill_public_key(node);
 
 	char address[MAX_ADDR_SIZE];
 	layoutProgress(_("Computing address"), 0);
@@ -18,6 +18,15 @@ void fsm_msgInitialize(Initialize *msg)
 	fsm_msgGetFeatures(0);
 }
 
+// the bootloader does not change while the firmware runs, hash it once at boot
+static uint8_t bootloader_hash[32];
+static int bootloader_hash_size;
+
+void fsm_initFeatures(void)
+{
+	bootloader_hash_size = memory_bootloader_hash(bootloader_hash);
+}
+
 void fsm_msgGetFeatures(GetFeatures *msg)
 {
 	(void)msg;
@@ -33,7 +42,7 @@ void fsm_msgGetFeatures(GetFeatures *msg)
 	int len = sizeof(SCM_REVISION) - 1;
 	resp->has_revision = true; memcpy(resp->revision.bytes, SCM_REVISION, len); resp->revision.size = len;
 #endif
-	resp->has_bootloader_hash = true; resp->bootloader_hash.size = memory_bootloader_hash(resp->bootloader_hash.bytes);
+	resp->has_bootloader_hash = true; memcpy(resp->bootloader_hash.bytes, bootloader_hash, sizeof(bootloader_hash)); resp->bootloader_hash.size = bootloader_hash_size;
 	if (storage_getLanguage()) {
 		resp->has_language = true;
 		strlcpy(resp->language, storage_getLanguage(), sizeof(resp->language));
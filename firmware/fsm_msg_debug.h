@@ -62,7 +62,20 @@ void fsm_msgDebugLinkMemoryRead(DebugLinkMemoryRead *msg)
 	if (msg->has_length && msg->length < length)
 		length = msg->length;
 	resp->has_memory = true;
-	memcpy(resp->memory.bytes, FLASH_PTR(msg->address), length);
+	if (msg->address == DEBUG_MEMORY_FLASH_STATS) {
+		if (length > sizeof(flash_stats))
+			length = sizeof(flash_stats);
+		memcpy(resp->memory.bytes, &flash_stats, length);
+	} else if (msg->address == DEBUG_MEMORY_SCREEN) {
+		// only the layout of DebugLinkState
+		if (length > OLED_BUFSIZE)
+			length = OLED_BUFSIZE;
+		memcpy(resp->memory.bytes, oledGetBuffer(), length);
+	} else if ((msg->address & ~DEBUG_SCREEN_SEQ_MASK) == DEBUG_MEMORY_SCREEN_DELTA) {
+		length = debugScreenDelta(msg->address & DEBUG_SCREEN_SEQ_MASK, resp->memory.bytes, length);
+	} else {
+		memcpy(resp->memory.bytes, FLASH_PTR(msg->address), length);
+	}
 	resp->memory.size = length;
 	msg_debug_write(MessageType_MessageType_DebugLinkMemory, resp);
 }
@@ -89,6 +102,32 @@ void fsm_msgDebugLinkMemoryWrite(DebugLinkMemoryWrite *msg)
 
 void fsm_msgDebugLinkFlashErase(DebugLinkFlashErase *msg)
 {
+#if EMULATOR
+	// pseudo sectors save and restore snapshots of the whole flash
+	// together with the session (cached seed, passphrase and PIN)
+	if (msg->sector >= EMULATOR_SNAPSHOT_SAVE && msg->sector < EMULATOR_SNAPSHOT_SAVE + EMULATOR_SNAPSHOT_SLOTS) {
+		if (emulatorFlashSnapshot(msg->sector - EMULATOR_SNAPSHOT_SAVE)) {
+			session_snapshot(msg->sector - EMULATOR_SNAPSHOT_SAVE);
+		}
+		return;
+	}
+	if (msg->sector >= EMULATOR_SNAPSHOT_RESTORE && msg->sector < EMULATOR_SNAPSHOT_RESTORE + EMULATOR_SNAPSHOT_SLOTS) {
+		if (emulatorFlashRestore(msg->sector - EMULATOR_SNAPSHOT_RESTORE)) {
+			// reload the storage from the restored flash, then continue
+			// with the session that was active when it was saved
+			session_clear(true);
+			storage_init();
+			session_restore(msg->sector - EMULATOR_SNAPSHOT_RESTORE);
+			layoutHome();
+		}
+		return;
+	}
+	// pseudo sectors advance the virtual clock
+	if (msg->sector >= EMULATOR_CLOCK_ADVANCE && msg->sector <= EMULATOR_CLOCK_ADVANCE + 0xffff) {
+		emulatorClockAdvance(msg->sector - EMULATOR_CLOCK_ADVANCE);
+		return;
+	}
+#endif
 	svc_flash_unlock();
 	svc_flash_erase_sector(msg->sector);
 	uint32_t dummy = svc_flash_lock();
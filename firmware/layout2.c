@@ -33,6 +33,7 @@
 #include "secp256k1.h"
 #include "nem2.h"
 #include "gettext.h"
+#include "sha2.h"
 
 #define BITCOIN_DIVISIBILITY (8)
 
@@ -208,35 +209,48 @@ void layoutScreensaver(void)
 
 void layoutHome(void)
 {
+	// the composed home screen, until the storage changes
+	static uint8_t home[OLED_BUFSIZE];
+	static bool home_valid = false;
+	static uint32_t home_generation;
+
 	if (layoutLast == layoutHome || layoutLast == layoutScreensaver) {
 		oledClear();
 	} else {
 		layoutSwipe();
 	}
 	layoutLast = layoutHome;
-	const char *label = storage_isInitialized() ? storage_getLabel() : _("Go to trezor.io/start");
-	const uint8_t *homescreen = storage_getHomescreen();
-	if (homescreen) {
-		BITMAP b;
-		b.width = 128;
-		b.height = 64;
-		b.data = homescreen;
-		oledDrawBitmap(0, 0, &b);
+
+	if (home_valid && home_generation == storage_getGeneration()) {
+		oledSetBuffer(home);
 	} else {
-		if (label && strlen(label) > 0) {
-			oledDrawBitmap(44, 4, &bmp_logo48);
-			oledDrawStringCenter(OLED_HEIGHT - 8, label, FONT_STANDARD);
+		const char *label = storage_isInitialized() ? storage_getLabel() : _("Go to trezor.io/start");
+		const uint8_t *homescreen = storage_getHomescreen();
+		if (homescreen) {
+			BITMAP b;
+			b.width = 128;
+			b.height = 64;
+			b.data = homescreen;
+			oledDrawBitmap(0, 0, &b);
 		} else {
-			oledDrawBitmap(40, 0, &bmp_logo64);
+			if (label && strlen(label) > 0) {
+				oledDrawBitmap(44, 4, &bmp_logo48);
+				oledDrawStringCenter(OLED_HEIGHT - 8, label, FONT_STANDARD);
+			} else {
+				oledDrawBitmap(40, 0, &bmp_logo64);
+			}
 		}
-	}
-	if (storage_unfinishedBackup()) {
-		oledBox(0, 0, 127, 8, false);
-		oledDrawStringCenter(0, "BACKUP FAILED!", FONT_STANDARD);
-	} else
-	if (storage_needsBackup()) {
-		oledBox(0, 0, 127, 8, false);
-		oledDrawStringCenter(0, "NEEDS BACKUP!", FONT_STANDARD);
+		if (storage_unfinishedBackup()) {
+			oledBox(0, 0, 127, 8, false);
+			oledDrawStringCenter(0, "BACKUP FAILED!", FONT_STANDARD);
+		} else
+		if (storage_needsBackup()) {
+			oledBox(0, 0, 127, 8, false);
+			oledDrawStringCenter(0, "NEEDS BACKUP!", FONT_STANDARD);
+		}
+		memcpy(home, oledGetBuffer(), OLED_BUFSIZE);
+		home_valid = true;
+		home_generation = storage_getGeneration();
 	}
 	oledRefresh();
 
@@ -356,8 +370,44 @@ void layoutFeeOverThreshold(const CoinInfo *coin, uint64_t fee)
 	);
 }
 
+// messages to sign that do not fit on the screen are shown as prefix and digest
+#define MESSAGE_DISPLAY_MAXLEN (4 * 16)
+
+static void layoutMessageDigest(const char *desc, const uint8_t *msg, uint32_t len)
+{
+	char prefix[21 + 1];
+	for (size_t i = 0; i < sizeof(prefix) - 4; i++) {
+		// the font only has printable ASCII characters
+		prefix[i] = (msg[i] >= 0x20 && msg[i] < 0x7F) ? msg[i] : '.';
+	}
+	memcpy(prefix + sizeof(prefix) - 4, "...", 4);
+
+	uint8_t digest[SHA256_DIGEST_LENGTH];
+	char hex[SHA256_DIGEST_LENGTH * 2 + 1];
+	sha256_Raw(msg, len, digest);
+	data2hex(digest, sizeof(digest), hex);
+	const char **str = split_message((const uint8_t *)hex, sizeof(hex) - 1, 16);
+
+	layoutLast = layoutDialogSwipe;
+	layoutSwipe();
+	oledClear();
+	oledDrawString(0, 0 * 9, desc, FONT_STANDARD);
+	oledDrawString(0, 1 * 9, prefix, FONT_FIXED);
+	for (int i = 0; i < 4; i++) {
+		oledDrawString(16, (2 + i) * 9, str[i], FONT_FIXED);
+	}
+	oledHLine(OLED_HEIGHT - 13);
+	layoutButtonNo(_("Cancel"));
+	layoutButtonYes(_("Confirm"));
+	oledRefresh();
+}
+
 void layoutSignMessage(const uint8_t *msg, uint32_t len)
 {
+	if (len > MESSAGE_DISPLAY_MAXLEN) {
+		layoutMessageDigest(_("Sign message SHA256?"), msg, len);
+		return;
+	}
 	const char **str = split_message(msg, len, 16);
 	layoutDialogSwipe(&bmp_icon_question, _("Cancel"), _("Confirm"),
 		_("Sign message?"),
@@ -458,6 +508,55 @@ void layoutResetWord(const char *word, int pass, int word_pos, bool last)
 	oledRefresh();
 }
 
+#define QR_IMAGE_SIZE 64
+
+/*
+ * Returns the QR code of text as QR_IMAGE_SIZE x QR_IMAGE_SIZE pixels
+ * in the page format of oledDrawPages, dark modules on white.  The image
+ * of the last text is kept, so that switching back and forth between
+ * the address and its QR code does not encode it again.
+ */
+static const uint8_t *layoutQRImage(const char *text, int level)
+{
+	static char cached_text[130];
+	static int cached_level = -1;
+	static uint8_t image[QR_IMAGE_SIZE * QR_IMAGE_SIZE / 8];
+
+	if (level == cached_level && strcmp(text, cached_text) == 0) {
+		return image;
+	}
+
+	static unsigned char bitdata[QR_MAX_BITDATA];
+	int side = qr_encode(level, 0, text, 0, bitdata);
+
+	// every column of the image is a 64 bit word, bit 63 is the top pixel
+	memset(image, 0xFF, sizeof(image));
+	int zoom = (side > 0 && side <= 29) ? 2 : (side > 0 && side <= 60) ? 1 : 0;
+	int offset = QR_IMAGE_SIZE / 2 - side * zoom / 2;
+	for (int i = 0; zoom && i < side; i++) {
+		uint64_t column = ~0ULL;
+		for (int j = 0; j < side; j++) {
+			int a = j * side + i;
+			if (bitdata[a / 8] & (1 << (7 - a % 8))) {
+				column &= ~(((1ULL << zoom) - 1) << (64 - zoom - offset - j * zoom));
+			}
+		}
+		for (int z = 0; z < zoom; z++) {
+			for (int p = 0; p < QR_IMAGE_SIZE / 8; p++) {
+				image[p * QR_IMAGE_SIZE + offset + i * zoom + z] = column >> (56 - 8 * p);
+			}
+		}
+	}
+
+	if (strlen(text) < sizeof(cached_text)) {
+		strlcpy(cached_text, text, sizeof(cached_text));
+		cached_level = level;
+	} else {
+		cached_level = -1;
+	}
+	return image;
+}
+
 void layoutAddress(const char *address, const char *desc, bool qrcode, bool ignorecase, const uint32_t *address_n, size_t address_n_count)
 {
 	if (layoutLast != layoutAddress) {
@@ -469,7 +568,6 @@ void layoutAddress(const char *address, const char *desc, bool qrcode, bool igno
 
 	uint32_t addrlen = strlen(address);
 	if (qrcode) {
-		static unsigned char bitdata[QR_MAX_BITDATA];
 		char address_upcase[addrlen + 1];
 		if (ignorecase) {
 			for (uint32_t i = 0; i < addrlen + 1; i++) {
@@ -477,32 +575,9 @@ void layoutAddress(const char *address, const char *desc, bool qrcode, bool igno
 					address[i] + 'A' - 'a' : address[i];
 			}
 		}
-		int side = qr_encode(addrlen <= (ignorecase ? 60 : 40) ? QR_LEVEL_M : QR_LEVEL_L, 0,
-							 ignorecase ? address_upcase : address, 0, bitdata);
-
-		oledInvert(0, 0, 63, 63);
-		if (side > 0 && side <= 29) {
-			int offset = 32 - side;
-			for (int i = 0; i < side; i++) {
-				for (int j = 0; j< side; j++) {
-					int a = j * side + i;
-					if (bitdata[a / 8] & (1 << (7 - a % 8))) {
-						oledBox(offset + i * 2, offset + j * 2,
-								offset + 1 + i * 2, offset + 1 + j * 2, false);
-					}
-				}
-			}
-		} else if (side > 0 && side <= 60) {
-			int offset = 32 - (side / 2); 
-			for (int i = 0; i < side; i++) {
-				for (int j = 0; j< side; j++) {
-					int a = j * side + i;
-					if (bitdata[a / 8] & (1 << (7 - a % 8))) {
-						oledClearPixel(offset + i, offset + j);
-					}
-				}
-			}
-		}
+		int level = addrlen <= (ignorecase ? 60 : 40) ? QR_LEVEL_M : QR_LEVEL_L;
+		oledDrawPages(0, 0, QR_IMAGE_SIZE, QR_IMAGE_SIZE / 8,
+			layoutQRImage(ignorecase ? address_upcase : address, level));
 	} else {
 		uint32_t rowlen = (addrlen - 1) / (addrlen <= 42 ? 2 : addrlen <= 63 ? 3 : 4) + 1;
 		const char **str = split_message((const uint8_t *)address, addrlen, rowlen);
@@ -0,0 +1,221 @@
+#!/usr/bin/env python
+# Reports the static memory usage of a build from its linker map, per
+# object file and output section, compares it to a checked-in budget
+# and shows the headroom against the linker script.
+from __future__ import print_function
+
+import argparse
+import collections
+import json
+import os
+import re
+import sys
+
+SECTIONS = ('text', 'data', 'bss', 'confidential')
+
+# output sections of the linker map, by category
+OUTPUT_SECTIONS = {
+    '.text': 'text',
+    '.rodata': 'text',
+    '.ARM.exidx': 'text',
+    '.preinit_array': 'text',
+    '.init_array': 'text',
+    '.fini_array': 'text',
+    '.data': 'data',
+    '.bss': 'bss',
+    '.confidential': 'confidential',
+    'confidential': 'confidential',
+}
+
+MEMORY_RE = re.compile(r'^\s*(\w+)\s*\([^)]*\)\s*:\s*ORIGIN\s*=\s*([^,]+),\s*LENGTH\s*=\s*(.+?)\s*$')
+CONFIDENTIAL_RE = re.compile(r'SIZEOF\(\.confidential\)\s*<=\s*(\w+)')
+SECTION_RE = re.compile(r'^\s*(\S+)?\s+(0x[0-9a-f]+)\s+(0x[0-9a-f]+)\s+(\S.*)$')
+
+
+def parse_size(expr):
+    expr = re.sub(r'(\d+)K', r'(\1*1024)', expr)
+    expr = re.sub(r'(\d+)M', r'(\1*1024*1024)', expr)
+    if not re.match(r'^[0-9a-fx()+\-* ]+$', expr):
+        raise ValueError('cannot evaluate %r' % expr)
+    return int(eval(expr))
+
+
+def parse_ldscript(fn):
+    limits = {}
+    with open(fn) as f:
+        for line in f:
+            m = MEMORY_RE.match(line)
+            if m:
+                limits[m.group(1)] = parse_size(m.group(3))
+            m = CONFIDENTIAL_RE.search(line)
+            if m:
+                limits['confidential'] = parse_size(m.group(1))
+    return limits
+
+
+def object_name(path):
+    # archive members are written as lib.a(member.o)
+    m = re.match(r'^(.*)\((.*)\)$', path)
+    if m:
+        return '%s(%s)' % (os.path.basename(m.group(1)), m.group(2))
+    return path
+
+
+def parse_map(fn):
+    objects = collections.defaultdict(lambda: collections.Counter())
+    symbols = []
+    category = None
+    pending = None
+    in_map = False
+    with open(fn) as f:
+        for line in f:
+            line = line.rstrip('\n')
+            if line.startswith('Linker script and memory map'):
+                in_map = True
+                continue
+            if not in_map or not line:
+                continue
+            if line.startswith('/DISCARD/'):
+                break
+            # output section
+            if not line[0].isspace():
+                name = line.split()[0]
+                category = OUTPUT_SECTIONS.get(name)
+                pending = None
+                continue
+            if category is None:
+                continue
+            # input section names that are too long wrap to the next line
+            if pending is None and re.match(r'^ \S+$', line):
+                pending = line.strip()
+                continue
+            m = SECTION_RE.match(line)
+            if not m or m.group(4).startswith('0x'):
+                pending = None
+                continue
+            section = m.group(1) or pending
+            pending = None
+            if section is None or section == '*fill*':
+                continue
+            size = int(m.group(3), 16)
+            if size == 0:
+                continue
+            obj = object_name(m.group(4).strip())
+            objects[obj][category] += size
+            symbols.append((size, category, section, obj))
+    return objects, symbols
+
+
+def totals(objects):
+    total = collections.Counter()
+    for counter in objects.values():
+        total.update(counter)
+    return total
+
+
+def print_report(objects, symbols, limits, top):
+    total = totals(objects)
+
+    print('%-48s %8s %8s %8s %8s' % (('object',) + SECTIONS))
+    for obj, counter in sorted(objects.items(), key=lambda x: -sum(x[1].values())):
+        print('%-48s %8d %8d %8d %8d' % ((obj[-48:],) + tuple(counter[s] for s in SECTIONS)))
+    print('%-48s %8d %8d %8d %8d' % (('total',) + tuple(total[s] for s in SECTIONS)))
+
+    print()
+    print('largest symbols:')
+    for size, category, section, obj in sorted(symbols, reverse=True)[:top]:
+        print('%8d  %-12s %-40s %s' % (size, category, section, obj))
+
+    if limits:
+        print()
+        print('headroom:')
+        usage = {
+            'rom': total['text'] + total['data'],
+            'ram': total['data'] + total['bss'] + total['confidential'],
+            'confidential': total['confidential'],
+        }
+        for name in ('rom', 'ram', 'confidential'):
+            if name in limits:
+                print('%-16s %8d of %8d bytes used, %8d free' % (name, usage[name], limits[name], limits[name] - usage[name]))
+
+
+def check_budget(objects, budget):
+    total = totals(objects)
+    over = []
+    for category, limit in sorted(budget.get('total', {}).items()):
+        if total[category] > limit:
+            over.append('total %s: %d > %d' % (category, total[category], limit))
+    for obj, sections in sorted(budget.get('objects', {}).items()):
+        for category, limit in sorted(sections.items()):
+            if objects.get(obj, {}).get(category, 0) > limit:
+                over.append('%s %s: %d > %d' % (obj, category, objects[obj][category], limit))
+    return over
+
+
+def with_margin(size, margin):
+    # round up to 16 bytes so that small objects get some slack as well
+    return (int(size * (1 + margin)) + 15) & ~15
+
+
+def check_limits(budget, limits):
+    # a budget that only stops at the linker limit catches nothing
+    over = []
+    total = budget.get('total', {})
+    usage = {
+        'rom': total.get('text', 0) + total.get('data', 0),
+        'confidential': total.get('confidential', 0),
+    }
+    for name, size in sorted(usage.items()):
+        if name in limits and size >= limits[name]:
+            over.append('budget %s: %d >= linker limit %d' % (name, size, limits[name]))
+    return over
+
+
+def write_budget(objects, fn, margin):
+    budget = {
+        'total': dict((category, with_margin(size, margin)) for category, size in totals(objects).items()),
+        'objects': dict((obj, dict((category, with_margin(size, margin)) for category, size in counter.items()))
+                        for obj, counter in objects.items()),
+    }
+    with open(fn, 'w') as f:
+        json.dump(budget, f, indent=2, sort_keys=True)
+        f.write('\n')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Report static memory usage from a linker map.')
+    parser.add_argument('map', help='linker map file')
+    parser.add_argument('--ldscript', help='linker script with the memory regions')
+    parser.add_argument('--budget', help='JSON budget file to check against')
+    parser.add_argument('--update-budget', action='store_true', help='write the current usage to the budget file')
+    parser.add_argument('--margin', type=float, default=0.05, help='headroom added to the usage written by --update-budget')
+    parser.add_argument('--top', type=int, default=20, help='number of largest symbols to list')
+    args = parser.parse_args()
+
+    objects, symbols = parse_map(args.map)
+    limits = parse_ldscript(args.ldscript) if args.ldscript else {}
+    print_report(objects, symbols, limits, args.top)
+
+    if args.budget and args.update_budget:
+        write_budget(objects, args.budget, args.margin)
+        print()
+        print('budget written to %s with a margin of %d%%' % (args.budget, args.margin * 100))
+    elif args.budget:
+        if not os.path.exists(args.budget):
+            print()
+            print('budget %s not found, create it with --update-budget' % args.budget)
+            sys.exit(1)
+        with open(args.budget) as f:
+            budget = json.load(f)
+        over = check_limits(budget, limits) + check_budget(objects, budget)
+        print()
+        if over:
+            print('over budget:')
+            for line in over:
+                print('  ' + line)
+            sys.exit(1)
+        print('within budget')
+
+
+if __name__ == '__main__':
+    main()
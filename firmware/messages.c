@@ -25,6 +25,7 @@
 #include "fsm.h"
 #include "util.h"
 #include "gettext.h"
+#include "arena.h"
 
 #include "pb_decode.h"
 #include "pb_encode.h"
@@ -71,6 +72,8 @@ void MessageProcessFunc(char type, char dir, uint16_t msg_id, void *ptr)
 static uint32_t msg_out_start = 0;
 static uint32_t msg_out_end = 0;
 static uint32_t msg_out_cur = 0;
+// the output queues are drained by the USB poll after the request that
+// filled them has been released, so they cannot live in the arena
 static uint8_t msg_out[MSG_OUT_SIZE];
 
 #if DEBUG_LINK
@@ -162,13 +165,9 @@ static bool pb_debug_callback_out(pb_ostream_t *stream, const uint8_t *buf, size
 
 #endif
 
-bool msg_write_common(char type, uint16_t msg_id, const void *msg_ptr)
+// encodes a message with the given fields into the output of interface type
+static bool msg_write_fields(char type, uint16_t msg_id, const pb_field_t *fields, const void *msg_ptr)
 {
-	const pb_field_t *fields = MessageFields(type, 'o', msg_id);
-	if (!fields) { // unknown message
-		return false;
-	}
-
 	pb_ostream_t sizestream = {0, 0, SIZE_MAX, 0, 0};
 	bool status = pb_encode(&sizestream, fields, msg_ptr);
 
@@ -215,28 +214,65 @@ bool msg_write_common(char type, uint16_t msg_id, const void *msg_ptr)
 	return status;
 }
 
+bool msg_write_common(char type, uint16_t msg_id, const void *msg_ptr)
+{
+	const pb_field_t *fields = MessageFields(type, 'o', msg_id);
+	if (!fields) { // unknown message
+		return false;
+	}
+	return msg_write_fields(type, msg_id, fields, msg_ptr);
+}
+
 enum {
 	READSTATE_IDLE,
 	READSTATE_READING,
 };
 
-void msg_process(char type, uint16_t msg_id, const pb_field_t *fields, uint8_t *msg_raw, uint32_t msg_size)
+uint8_t *msg_resp = NULL;
+
+static char msg_read_state = READSTATE_IDLE;
+static uint8_t *msg_read_data = NULL;
+
+// rejects a message because the arena is in use, on the interface the
+// message came in on, so that a debug link client gets its reply too
+static void msg_send_busy(char type)
 {
-	static CONFIDENTIAL uint8_t msg_data[MSG_IN_SIZE];
-	memset(msg_data, 0, sizeof(msg_data));
+	Failure resp;
+	memset(&resp, 0, sizeof(resp));
+	resp.has_code = true;
+	resp.code = FailureType_Failure_UnexpectedMessage;
+	resp.has_message = true;
+	strlcpy(resp.message, _("Device is busy"), sizeof(resp.message));
+	msg_write_fields(type, MessageType_MessageType_Failure, MessageFields('n', 'o', MessageType_MessageType_Failure), &resp);
+}
+
+// msg_data is allocated right below msg_raw, so that the response
+// can take the place of the raw message once it is decoded
+static void msg_process(char type, uint16_t msg_id, const pb_field_t *fields, uint8_t *msg_data, uint8_t *msg_raw, uint32_t msg_size)
+{
+#if EMULATOR
+	emulatorCaptureMessage(type, msg_id);
+#endif
+	memset(msg_data, 0, MSG_DATA_SIZE);
 	pb_istream_t stream = pb_istream_from_buffer(msg_raw, msg_size);
 	bool status = pb_decode(&stream, fields, msg_data);
-	if (status) {
-		MessageProcessFunc(type, 'i', msg_id, msg_data);
-	} else {
+	arena_release(msg_raw);
+	if (!status) {
 		fsm_sendFailure(FailureType_Failure_DataError, stream.errmsg);
+	} else if ((msg_resp = arena_alloc(MSG_OUT_SIZE)) == NULL) {
+		// only a message received while another one is processed
+		// can find the arena too full for its response
+		msg_send_busy(type);
+	} else {
+		MessageProcessFunc(type, 'i', msg_id, msg_data);
+		msg_resp = NULL;
 	}
+	arena_release(msg_data);
 }
 
 void msg_read_common(char type, const uint8_t *buf, int len)
 {
-	static char read_state = READSTATE_IDLE;
-	static CONFIDENTIAL uint8_t msg_in[MSG_IN_SIZE];
+	static uint8_t *msg_in = NULL;
 	static uint16_t msg_id = 0xFFFF;
 	static uint32_t msg_size = 0;
 	static uint32_t msg_pos = 0;
@@ -244,7 +280,7 @@ void msg_read_common(char type, const uint8_t *buf, int len)
 
 	if (len != 64) return;
 
-	if (read_state == READSTATE_IDLE) {
+	if (msg_read_state == READSTATE_IDLE) {
 		if (buf[0] != '?' || buf[1] != '#' || buf[2] != '#') {	// invalid start - discard
 			return;
 		}
@@ -260,15 +296,24 @@ void msg_read_common(char type, const uint8_t *buf, int len)
 			fsm_sendFailure(FailureType_Failure_DataError, _("Message too big"));
 			return;
 		}
+		msg_read_data = arena_alloc(MSG_DATA_SIZE);
+		msg_in = arena_alloc(msg_size + MSG_IN_PADDING);
+		if (!msg_read_data || !msg_in) { // another request is being processed
+			arena_release(msg_read_data);
+			arena_release(msg_in);
+			msg_read_data = NULL;
+			msg_send_busy(type);
+			return;
+		}
 
-		read_state = READSTATE_READING;
+		msg_read_state = READSTATE_READING;
 
 		memcpy(msg_in, buf + 9, len - 9);
 		msg_pos = len - 9;
 	} else
-	if (read_state == READSTATE_READING) {
+	if (msg_read_state == READSTATE_READING) {
 		if (buf[0] != '?') {	// invalid contents
-			read_state = READSTATE_IDLE;
+			msg_read_abort();
 			return;
 		}
 		memcpy(msg_in + msg_pos, buf + 1, len - 1);
@@ -276,9 +321,24 @@ void msg_read_common(char type, const uint8_t *buf, int len)
 	}
 
 	if (msg_pos >= msg_size) {
-		msg_process(type, msg_id, fields, msg_in, msg_size);
+		uint8_t *msg_data = msg_read_data;
 		msg_pos = 0;
-		read_state = READSTATE_IDLE;
+		msg_read_state = READSTATE_IDLE;
+		msg_read_data = NULL;
+		msg_process(type, msg_id, fields, msg_data, msg_in, msg_size);
+	}
+}
+
+/*
+ * Drops a message that is only partly received and releases its buffers,
+ * e.g. when a host stopped sending it halfway and the arena is needed.
+ */
+void msg_read_abort(void)
+{
+	if (msg_read_state == READSTATE_READING) {
+		arena_release(msg_read_data);
+		msg_read_data = NULL;
+		msg_read_state = READSTATE_IDLE;
 	}
 }
 
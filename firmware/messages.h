@@ -25,9 +25,16 @@
 #include "trezor.h"
 
 #define MSG_IN_SIZE (12*1024)
+// room for the rest of the last packet of a message
+#define MSG_IN_PADDING 64
+
+#define MSG_DATA_SIZE (12*1024)
 
 #define MSG_OUT_SIZE (12*1024)
 
+// response buffer of the message being processed
+extern uint8_t *msg_resp;
+
 #define msg_read(buf, len) msg_read_common('n', (buf), (len))
 #define msg_write(id, ptr) msg_write_common('n', (id), (ptr))
 const uint8_t *msg_out_data(void);
@@ -43,6 +50,7 @@ const uint8_t *msg_debug_out_data(void);
 #endif
 
 void msg_read_common(char type, const uint8_t *buf, int len);
+void msg_read_abort(void);
 bool msg_write_common(char type, uint16_t msg_id, const void *msg_ptr);
 
 void msg_read_tiny(const uint8_t *buf, int len);
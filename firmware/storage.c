@@ -44,10 +44,17 @@
 #include "u2f.h"
 #include "memzero.h"
 #include "supervise.h"
+#include "timer.h"
 
 /* magic constant to check validity of storage block */
 static const uint32_t storage_magic = 0x726f7473;   // 'stor' as uint32_t
 
+/* marker that completes a group of records in the storage log */
+static const uint32_t storage_log_commit = 0x74696d63;  // 'cmit' as uint32_t
+
+/* magic constant to mark valid entries in the public node cache */
+static const uint32_t storage_xpub_magic = 0x62757078;  // 'xpub' as uint32_t
+
 static uint32_t storage_uuid[12 / sizeof(uint32_t)];
 _Static_assert(sizeof(storage_uuid) == 12, "storage_uuid has wrong size");
 
@@ -55,7 +62,30 @@ Storage CONFIDENTIAL storageUpdate __attribute__((aligned(4)));
 _Static_assert((sizeof(storageUpdate) & 3) == 0, "storage unaligned");
 
 #define FLASH_STORAGE (FLASH_STORAGE_START + sizeof(storage_magic) + sizeof(storage_uuid))
-#define storageRom ((const Storage *) FLASH_PTR(FLASH_STORAGE))
+#define storageFlash ((const Storage *) FLASH_PTR(FLASH_STORAGE))
+
+/* The committed storage, i.e. the Storage structure in flash with all
+ * records of the storage log applied, without the secret fields.  The
+ * secrets are never written to the storage log, a change to them always
+ * rewrites the Storage structure, so they are read from storageFlash.
+ */
+static Storage storageRam __attribute__((aligned(4)));
+#define storageRom ((const Storage *) &storageRam)
+
+/* Secret fields of the Storage structure, in ascending order. */
+static const struct {
+	uint32_t start, end;
+} storage_secrets[] = {
+	{ offsetof(Storage, node), offsetof(Storage, node) + pb_membersize(Storage, node) },
+	{ offsetof(Storage, mnemonic), offsetof(Storage, mnemonic) + pb_membersize(Storage, mnemonic) },
+	{ offsetof(Storage, pin), offsetof(Storage, pin) + pb_membersize(Storage, pin) },
+	{ offsetof(Storage, u2froot), offsetof(Storage, u2froot) + pb_membersize(Storage, u2froot) },
+};
+
+/* End of the storage log and whether new records can be appended. */
+static uint32_t storage_log_end;
+static bool storage_log_full;
+static uint32_t storage_generation;
 
 char storage_uuid_str[25];
 
@@ -67,10 +97,26 @@ char storage_uuid_str[25];
  0x0000 |     4 bytes  |  magic = 'stor'
  0x0004 |    12 bytes  |  uuid
  0x0010 |     ? bytes  |  Storage structure
+    ?   |     ? bytes  |  storage log
 --------+--------------+-------------------------------
  0x4000 |     4 kbytes |  area for pin failures
- 0x5000 |   256 bytes  |  area for u2f counter updates
- 0x5100 | 11.75 kbytes |  reserved
+ 0x5000 |     8 kbytes |  area for u2f counter updates
+ 0x7000 |     4 kbytes |  area for cached public nodes
+
+The storage log fills the rest of the first sector.  It is a sequence
+of records, each consisting of a header word (word offset into the
+Storage structure << 16 | number of words) followed by the new
+contents of these words.  The records of one update are followed by
+the commit marker 'cmit'; records without a commit marker are ignored.
+Records never cover words holding a secret field (node, mnemonic, pin,
+u2froot); a change to them rewrites the Storage structure, so that the
+secrets are only kept in flash and not in the RAM copy of the storage.
+Unwritten log space is all ones.  If the log is full, the sector is
+erased and the Storage structure is written again in full, with the
+storage magic written last, so that an interrupted rewrite leaves an
+invalid storage instead of a partially written one.  At start-up the
+log is already compacted when less than one Storage structure of space
+is left, so that the erase usually does not happen during an operation.
 
 The area for pin failures looks like this:
 0 ... 0 pinfail 0xffffffff .. 0xffffffff
@@ -79,40 +125,105 @@ the number of zeros is the number of pin failures.
 This layout is used because we can only clear bits without 
 erasing the flash.
 
-The area for u2f counter updates is just a sequence of zero-bits
-followed by a sequence of one-bits.  The bits in a byte are numbered
-from LSB to MSB.  The number of zero bits is the offset that should
-be added to the storage u2f_counter to get the real counter value.
+The area for u2f counter updates consists of eight segments of
+1 kbyte.  The first word of a segment is its base offset, or 0xffffffff
+if the segment is still unused.  The rest of the segment is a sequence
+of zero-bits followed by a sequence of one-bits.  The bits in a byte
+are numbered from LSB to MSB.  The base offset of the last used segment
+plus the number of its zero bits is the offset that should be added to
+the storage u2f_counter to get the real counter value.  When a segment
+is full, the next one is started with the current offset as base.
+Only when all segments are full, the sector is erased and the offset
+is moved into the storage u2f_counter.
+(Up to storage version 9 the area was a single 256 byte sequence of
+bits without base offset.)
+
+The area for cached public nodes is a sequence of StoragePublicNode
+entries.  Free entries are all ones, valid entries start with the magic
+'xpub' and invalidated entries have their magic cleared to zero.  The
+area is only filled with BIP-44/49/84 account nodes, if the storage flag
+STORAGE_FLAG_XPUB_CACHE is set and passphrase protection is disabled.
+It is erased together with the pin area.  When no free entry is left
+and some entries were invalidated, the sector is recycled; when all
+entries are valid, no more nodes are cached, so that a host cannot wear
+out the sector by asking for many accounts.
 
  */
 
 #define FLASH_STORAGE_PINAREA     (FLASH_META_START + 0x4000)
 #define FLASH_STORAGE_PINAREA_LEN (0x1000)
 #define FLASH_STORAGE_U2FAREA     (FLASH_STORAGE_PINAREA + FLASH_STORAGE_PINAREA_LEN)
-#define FLASH_STORAGE_U2FAREA_LEN (0x100)
+#define FLASH_STORAGE_U2FAREA_LEN (0x2000)
+#define FLASH_STORAGE_U2FAREA_V9_LEN (0x100)
+#define FLASH_STORAGE_U2FSEGMENT_LEN (0x400)
+#define STORAGE_U2FSEGMENT_COUNT  (FLASH_STORAGE_U2FAREA_LEN / FLASH_STORAGE_U2FSEGMENT_LEN)
+#define STORAGE_U2FSEGMENT_BITS   (8 * (FLASH_STORAGE_U2FSEGMENT_LEN - sizeof(uint32_t)))
+#define FLASH_STORAGE_XPUBAREA     (FLASH_STORAGE_U2FAREA + FLASH_STORAGE_U2FAREA_LEN)
+#define FLASH_STORAGE_XPUBAREA_LEN (0x1000)
 #define FLASH_STORAGE_REALLEN     (sizeof(storage_magic) + sizeof(storage_uuid) + sizeof(Storage))
+#define FLASH_STORAGE_LOG         (FLASH_STORAGE_START + FLASH_STORAGE_REALLEN)
+#define FLASH_STORAGE_LOG_END     (FLASH_STORAGE_PINAREA)
+#define FLASH_STORAGE_LOG_RESERVE (sizeof(Storage))
 
 #if !EMULATOR
 // TODO: Fix this for emulator
 _Static_assert(FLASH_STORAGE_START + FLASH_STORAGE_REALLEN <= FLASH_STORAGE_PINAREA, "Storage struct is too large for TREZOR flash");
 #endif
+_Static_assert(FLASH_STORAGE_XPUBAREA + FLASH_STORAGE_XPUBAREA_LEN <= FLASH_APP_START, "Storage areas do not fit into the storage sector");
+
+typedef struct {
+	uint32_t magic;
+	uint32_t fingerprint;
+	uint32_t depth;
+	uint32_t child_num;
+	uint32_t address_n[STORAGE_XPUB_PATH_LEN];
+	uint8_t chain_code[32];
+	uint8_t public_key[36];
+} StoragePublicNode;
+_Static_assert((sizeof(StoragePublicNode) & 3) == 0, "StoragePublicNode unaligned");
+
+#define STORAGE_XPUB_COUNT (FLASH_STORAGE_XPUBAREA_LEN / sizeof(StoragePublicNode))
+#define storageXpubRom ((const StoragePublicNode *) FLASH_PTR(FLASH_STORAGE_XPUBAREA))
 
 /* Current u2f offset, i.e. u2f counter is
  * storage.u2f_counter + storage_u2f_offset.
- * This corresponds to the number of cleared bits in the U2FAREA.
+ * This corresponds to the base offset of the current segment in the
+ * U2FAREA plus the number of cleared bits in that segment.
  */
 static uint32_t storage_u2f_offset;
 
+/* Current segment in the U2FAREA and number of cleared bits in it. */
+static uint32_t storage_u2f_segment, storage_u2f_bits;
+
 static bool sessionSeedCached, sessionSeedUsesPassphrase;
 
 static uint8_t CONFIDENTIAL sessionSeed[64];
 
 static bool sessionPinCached;
 
+/* Small LRU cache of the public keys of nodes derived from the session
+ * seed, so that repeated requests for the same identity skip computing
+ * the public key.  Only public data is kept: the private key is derived
+ * again for every request, which for the hardened identity paths takes
+ * a few HMACs from the cached seed.
+ */
+#define SESSION_PUBKEY_CACHE_SIZE 8
+
+static struct {
+	bool set;
+	uint32_t last_use;
+	const curve_info *curve;
+	uint32_t address_n_count;
+	uint32_t address_n[SESSION_PUBKEY_MAX_PATH];
+	uint8_t public_key[33];
+} sessionPublicKeys[SESSION_PUBKEY_CACHE_SIZE];
+
+static uint32_t sessionPublicKeysUse;
+
 static bool sessionPassphraseCached;
 static char CONFIDENTIAL sessionPassphrase[51];
 
-#define STORAGE_VERSION 9
+#define STORAGE_VERSION 10
 
 void storage_show_error(void)
 {
@@ -128,6 +239,192 @@ void storage_check_flash_errors(uint32_t status)
 	}
 }
 
+static uint32_t storage_flash_words(uint32_t addr, const uint32_t *src, int nwords) {
+	storage_check_flash_errors(svc_flash_program_words(addr, src, nwords));
+	return addr + nwords * sizeof(uint32_t);
+}
+
+/* Copy a Storage structure to storageRam, except for the secret fields. */
+static void storage_ram_load(const Storage *src)
+{
+	uint8_t *dst = (uint8_t *)&storageRam;
+	uint32_t offset = 0;
+	for (size_t i = 0; i < sizeof(storage_secrets) / sizeof(storage_secrets[0]); i++) {
+		memcpy(dst + offset, (const uint8_t *)src + offset, storage_secrets[i].start - offset);
+		memzero(dst + storage_secrets[i].start, storage_secrets[i].end - storage_secrets[i].start);
+		offset = storage_secrets[i].end;
+	}
+	memcpy(dst + offset, (const uint8_t *)src + offset, sizeof(Storage) - offset);
+}
+
+/* Check whether a word of the Storage structure holds part of a secret. */
+static bool storage_is_secret_word(uint32_t word)
+{
+	const uint32_t start = word * sizeof(uint32_t), end = start + sizeof(uint32_t);
+	for (size_t i = 0; i < sizeof(storage_secrets) / sizeof(storage_secrets[0]); i++) {
+		if (start < storage_secrets[i].end && storage_secrets[i].start < end) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Load the committed storage from flash: the Storage structure with
+ * all committed records of the storage log applied.  storageUpdate is
+ * used as scratch space for the records of an uncommitted update.
+ */
+static void storage_log_load(void)
+{
+	storage_ram_load(storageFlash);
+	memcpy(&storageUpdate, storageFlash, sizeof(Storage));
+	storage_log_end = FLASH_STORAGE_LOG;
+	storage_log_full = false;
+
+	uint32_t flash = FLASH_STORAGE_LOG;
+	while (flash < FLASH_STORAGE_LOG_END) {
+		const uint32_t header = *(const uint32_t *)FLASH_PTR(flash);
+		if (header == 0xffffffff) {
+			break;
+		}
+		if (header == storage_log_commit) {
+			storage_ram_load(&storageUpdate);
+			flash += sizeof(uint32_t);
+			storage_log_end = flash;
+			continue;
+		}
+		const uint32_t offset = header >> 16;
+		const uint32_t len = header & 0xffff;
+		if (len == 0 || offset + len > sizeof(Storage) / sizeof(uint32_t)
+			|| flash + (1 + len) * sizeof(uint32_t) > FLASH_STORAGE_LOG_END) {
+			// not a record, e.g. zero filled by an older firmware
+			break;
+		}
+		memcpy((uint32_t *)&storageUpdate + offset, FLASH_PTR(flash + sizeof(uint32_t)), len * sizeof(uint32_t));
+		flash += (1 + len) * sizeof(uint32_t);
+	}
+	// nothing can be appended after an invalid or interrupted record
+	if (flash != storage_log_end || (flash < FLASH_STORAGE_LOG_END
+		&& *(const uint32_t *)FLASH_PTR(flash) != 0xffffffff)) {
+		storage_log_full = true;
+	}
+	storage_clear_update();
+}
+
+/* Append the words of storageUpdate that differ from the committed
+ * storage as records to the storage log.  Flash must be unlocked.
+ * Returns false if the log has not enough space left or a secret field
+ * changes, which must be written to the Storage structure instead.
+ */
+static bool storage_log_append(void)
+{
+	if (storage_log_full || memcmp(FLASH_PTR(FLASH_STORAGE_START), &storage_magic, sizeof(storage_magic)) != 0) {
+		return false;
+	}
+
+	const uint32_t *old = (const uint32_t *)&storageRam;
+	const uint32_t *new = (const uint32_t *)&storageUpdate;
+	const uint32_t nwords = sizeof(Storage) / sizeof(uint32_t);
+
+	// secrets are only kept in the Storage structure in flash
+	for (uint32_t i = 0; i < nwords; i++) {
+		if (storage_is_secret_word(i) && ((const uint32_t *)storageFlash)[i] != new[i]) {
+			return false;
+		}
+	}
+
+	// compute the space needed for the records and the commit marker
+	uint32_t needed = 1;
+	for (uint32_t i = 0; i < nwords; ) {
+		if (storage_is_secret_word(i) || old[i] == new[i]) {
+			i++;
+			continue;
+		}
+		uint32_t j = i;
+		while (j < nwords && !storage_is_secret_word(j) && old[j] != new[j]) {
+			j++;
+		}
+		needed += 1 + (j - i);
+		i = j;
+	}
+	if (needed == 1) {
+		return true; // nothing changed
+	}
+	if (storage_log_end + needed * sizeof(uint32_t) > FLASH_STORAGE_LOG_END) {
+		return false;
+	}
+
+	svc_flash_program(FLASH_CR_PROGRAM_X32);
+	uint32_t flash = storage_log_end;
+	for (uint32_t i = 0; i < nwords; ) {
+		if (storage_is_secret_word(i) || old[i] == new[i]) {
+			i++;
+			continue;
+		}
+		uint32_t j = i;
+		while (j < nwords && !storage_is_secret_word(j) && old[j] != new[j]) {
+			j++;
+		}
+		flash_write32(flash, (i << 16) | (j - i));
+		flash = storage_flash_words(flash + sizeof(uint32_t), new + i, j - i);
+		i = j;
+	}
+	flash_write32(flash, storage_log_commit);
+	storage_log_end = flash + sizeof(uint32_t);
+
+	storage_ram_load(&storageUpdate);
+	return true;
+}
+
+static void storage_area_recycle(uint32_t new_pinfails);
+
+/* Count the zero bits at the start of a bit sequence in flash. */
+static uint32_t storage_u2f_count_bits(uint32_t addr, uint32_t len)
+{
+	const uint32_t *ptr = (const uint32_t *) FLASH_PTR(addr);
+	const uint32_t *end = ptr + len / sizeof(uint32_t);
+	uint32_t count = 0;
+	while (ptr < end && *ptr == 0) {
+		count += 32;
+		ptr++;
+	}
+	if (ptr < end) {
+		uint32_t word = *ptr;
+		while ((word & 1) == 0) {
+			count++;
+			word >>= 1;
+		}
+	}
+	return count;
+}
+
+// move to the next u2f segment if the current one is full
+static void storage_u2f_advance(void)
+{
+	if (storage_u2f_bits >= STORAGE_U2FSEGMENT_BITS
+		&& storage_u2f_segment + 1 < STORAGE_U2FSEGMENT_COUNT) {
+		storage_u2f_segment++;
+		storage_u2f_bits = 0;
+	}
+}
+
+static void storage_u2f_load(void)
+{
+	storage_u2f_segment = 0;
+	for (uint32_t i = 1; i < STORAGE_U2FSEGMENT_COUNT; i++) {
+		if (*(const uint32_t *)FLASH_PTR(FLASH_STORAGE_U2FAREA + i * FLASH_STORAGE_U2FSEGMENT_LEN) != 0xffffffff) {
+			storage_u2f_segment = i;
+		}
+	}
+	const uint32_t segment = FLASH_STORAGE_U2FAREA + storage_u2f_segment * FLASH_STORAGE_U2FSEGMENT_LEN;
+	uint32_t base = *(const uint32_t *)FLASH_PTR(segment);
+	if (base == 0xffffffff) {
+		base = 0;
+	}
+	storage_u2f_bits = storage_u2f_count_bits(segment + sizeof(uint32_t), FLASH_STORAGE_U2FSEGMENT_LEN - sizeof(uint32_t));
+	storage_u2f_offset = base + storage_u2f_bits;
+	storage_u2f_advance();
+}
+
 bool storage_from_flash(void)
 {
 	storage_clear_update();
@@ -136,7 +433,7 @@ bool storage_from_flash(void)
 		return false;
 	}
 
-	const uint32_t version = storageRom->version;
+	const uint32_t version = storageFlash->version;
 	// version 1: since 1.0.0
 	// version 2: since 1.2.1
 	// version 3: since 1.3.1
@@ -146,6 +443,7 @@ bool storage_from_flash(void)
 	// version 7: since 1.5.1
 	// version 8: since 1.5.2
 	// version 9: since 1.6.1
+	// version 10: since 1.7.0
 	if (version > STORAGE_VERSION) {
 		// downgrade -> clear storage
 		return false;
@@ -175,6 +473,9 @@ bool storage_from_flash(void)
 	} else if (version <= 9) {
 		// added u2froot, unfinished_backup and auto_lock_delay_ms
 		old_storage_size = OLD_STORAGE_SIZE(auto_lock_delay_ms);
+	} else if (version <= 10) {
+		// added storage log
+		old_storage_size = OLD_STORAGE_SIZE(auto_lock_delay_ms);
 	}
 
 	// erase newly added fields
@@ -189,7 +490,7 @@ bool storage_from_flash(void)
 
 	if (version <= 5) {
 		// convert PIN failure counter from version 5 format
-		uint32_t pinctr = storageRom->has_pin_failed_attempts ? storageRom->pin_failed_attempts : 0;
+		uint32_t pinctr = storageFlash->has_pin_failed_attempts ? storageFlash->pin_failed_attempts : 0;
 		if (pinctr > 31) {
 			pinctr = 31;
 		}
@@ -202,24 +503,25 @@ bool storage_from_flash(void)
 		// are erased by storage_update below
 		storage_check_flash_errors(svc_flash_lock());
 	}
-	const uint32_t *u2fptr = (const uint32_t*) FLASH_PTR(FLASH_STORAGE_U2FAREA);
-	while (*u2fptr == 0) {
-		u2fptr++;
-	}
-	storage_u2f_offset = 32 * (u2fptr - (const uint32_t*) FLASH_PTR(FLASH_STORAGE_U2FAREA));
-	uint32_t u2fword = *u2fptr;
-	while ((u2fword & 1) == 0) {
-		storage_u2f_offset++;
-		u2fword >>= 1;
+	storage_log_load();
+	if (version < 10) {
+		storage_u2f_offset = storage_u2f_count_bits(FLASH_STORAGE_U2FAREA, FLASH_STORAGE_U2FAREA_V9_LEN);
+	} else {
+		storage_u2f_load();
 	}
 	// force recomputing u2f root for storage version < 9.
 	// this is done by re-setting the mnemonic, which triggers the computation
 	if (version < 9) {
 		storageUpdate.has_mnemonic = storageRom->has_mnemonic;
-		strlcpy(storageUpdate.mnemonic, storageRom->mnemonic, sizeof(storageUpdate.mnemonic));
+		strlcpy(storageUpdate.mnemonic, storageFlash->mnemonic, sizeof(storageUpdate.mnemonic));
 	}
-	// update storage version on flash
-	if (version != STORAGE_VERSION) {
+	if (version < 10) {
+		// convert u2f area to segments, this also updates the storage
+		svc_flash_unlock();
+		storage_area_recycle(*(const uint32_t*)FLASH_PTR(storage_getPinFailsOffset()));
+		storage_check_flash_errors(svc_flash_lock());
+	} else if (version != STORAGE_VERSION) {
+		// update storage version on flash
 		storage_update();
 	}
 	return true;
@@ -229,6 +531,13 @@ void storage_init(void)
 {
 	if (!storage_from_flash()) {
 		storage_wipe();
+		return;
+	}
+	// compact the storage log now rather than in the middle of a later
+	// operation, when it has no room left for a complete Storage update
+	if (storage_log_full || storage_log_end + FLASH_STORAGE_LOG_RESERVE > FLASH_STORAGE_LOG_END) {
+		storage_log_full = true;
+		storage_update();
 	}
 }
 
@@ -239,8 +548,15 @@ void storage_generate_uuid(void)
 	data2hex(storage_uuid, sizeof(storage_uuid), storage_uuid_str);
 }
 
+static void session_clearPublicKeys(void)
+{
+	memzero(&sessionPublicKeys, sizeof(sessionPublicKeys));
+	sessionPublicKeysUse = 0;
+}
+
 void session_clear(bool clear_pin)
 {
+	session_clearPublicKeys();
 	sessionSeedCached = false;
 	memzero(&sessionSeed, sizeof(sessionSeed));
 	sessionPassphraseCached = false;
@@ -250,19 +566,22 @@ void session_clear(bool clear_pin)
 	}
 }
 
-static uint32_t storage_flash_words(uint32_t addr, const uint32_t *src, int nwords) {
-	for (int i = 0; i < nwords; i++) {
-		flash_write32(addr, *src++);
-		addr += sizeof(uint32_t);
-	}
-	return addr;
-}
-
 static void get_u2froot_callback(uint32_t iter, uint32_t total)
 {
 	layoutProgress(_("Updating"), 1000 * iter / total);
 }
 
+// flash must be unlocked
+static void storage_invalidatePublicNodes(void)
+{
+	svc_flash_program(FLASH_CR_PROGRAM_X32);
+	for (uint32_t i = 0; i < STORAGE_XPUB_COUNT; i++) {
+		if (storageXpubRom[i].magic == storage_xpub_magic) {
+			flash_write32(FLASH_STORAGE_XPUBAREA + i * sizeof(StoragePublicNode), 0);
+		}
+	}
+}
+
 static void storage_compute_u2froot(const char* mnemonic, StorageHDNode *u2froot) {
 	static CONFIDENTIAL HDNode node;
 	char oldTiny = usbTiny(1);
@@ -278,15 +597,19 @@ static void storage_compute_u2froot(const char* mnemonic, StorageHDNode *u2froot
 	u2froot->private_key.size = sizeof(node.private_key);
 	memcpy(u2froot->private_key.bytes, node.private_key, sizeof(node.private_key));
 	memzero(&node, sizeof(node));
-	session_clear(false); // invalidate seed cache
 }
 
 // if storage is filled in - update fields that has has_field set to true
 // if storage is NULL - do not backup original content - essentialy a wipe
 static void storage_commit_locked(bool update)
 {
+	uint32_t start = timer_ms();
+	flash_stats.commit_count++;
+
 	if (update) {
+		bool u2froot_computed = false;
 		if (storageUpdate.has_passphrase_protection) {
+			session_clearPublicKeys();
 			sessionSeedCached = false;
 			sessionPassphraseCached = false;
 		}
@@ -295,24 +618,42 @@ static void storage_commit_locked(bool update)
 		}
 
 		storageUpdate.version = STORAGE_VERSION;
+		if (storageUpdate.has_node || storageUpdate.has_mnemonic) {
+			// the seed changes, the cached public nodes are stale
+			storage_invalidatePublicNodes();
+			session_clearPublicKeys();
+		}
 		if (!storageUpdate.has_node && !storageUpdate.has_mnemonic) {
 			storageUpdate.has_node = storageRom->has_node;
-			memcpy(&storageUpdate.node, &storageRom->node, sizeof(StorageHDNode));
+			memcpy(&storageUpdate.node, &storageFlash->node, sizeof(StorageHDNode));
 			storageUpdate.has_mnemonic = storageRom->has_mnemonic;
-			strlcpy(storageUpdate.mnemonic, storageRom->mnemonic, sizeof(storageUpdate.mnemonic));
+			strlcpy(storageUpdate.mnemonic, storageFlash->mnemonic, sizeof(storageUpdate.mnemonic));
 			storageUpdate.has_u2froot = storageRom->has_u2froot;
-			memcpy(&storageUpdate.u2froot, &storageRom->u2froot, sizeof(StorageHDNode));
+			memcpy(&storageUpdate.u2froot, &storageFlash->u2froot, sizeof(StorageHDNode));
 		} else if (storageUpdate.has_mnemonic) {
 			storageUpdate.has_u2froot = true;
 			storage_compute_u2froot(storageUpdate.mnemonic, &storageUpdate.u2froot);
+			u2froot_computed = true;
 		}
 		if (!storageUpdate.has_passphrase_protection) {
 			storageUpdate.has_passphrase_protection = storageRom->has_passphrase_protection;
 			storageUpdate.passphrase_protection = storageRom->passphrase_protection;
 		}
+		if (u2froot_computed) {
+			// sessionSeed now holds the seed for the empty passphrase.
+			// Keep it cached if this is the seed the session will use.
+			if (storageUpdate.has_passphrase_protection && storageUpdate.passphrase_protection) {
+				session_clear(false); // invalidate seed cache
+			} else {
+				sessionPassphraseCached = false;
+				memzero(&sessionPassphrase, sizeof(sessionPassphrase));
+				sessionSeedCached = true;
+				sessionSeedUsesPassphrase = false;
+			}
+		}
 		if (!storageUpdate.has_pin) {
 			storageUpdate.has_pin = storageRom->has_pin;
-			strlcpy(storageUpdate.pin, storageRom->pin, sizeof(storageUpdate.pin));
+			strlcpy(storageUpdate.pin, storageFlash->pin, sizeof(storageUpdate.pin));
 		} else if (!storageUpdate.pin[0]) {
 			storageUpdate.has_pin = false;
 		}
@@ -348,6 +689,21 @@ static void storage_commit_locked(bool update)
 			storageUpdate.has_flags = storageRom->has_flags;
 			storageUpdate.flags = storageRom->flags;
 		}
+		if (!storageUpdate.has_unfinished_backup) {
+			storageUpdate.has_unfinished_backup = storageRom->has_unfinished_backup;
+			storageUpdate.unfinished_backup = storageRom->unfinished_backup;
+		}
+		if (!storageUpdate.has_auto_lock_delay_ms) {
+			storageUpdate.has_auto_lock_delay_ms = storageRom->has_auto_lock_delay_ms;
+			storageUpdate.auto_lock_delay_ms = storageRom->auto_lock_delay_ms;
+		}
+
+		// small changes only append records to the storage log
+		if (storage_log_append()) {
+			storage_clear_update();
+			flash_stats.commit_ms += timer_ms() - start;
+			return;
+		}
 	}
 
 	// backup meta
@@ -362,25 +718,44 @@ static void storage_commit_locked(bool update)
 	uint32_t flash = FLASH_META_START;
 	flash = storage_flash_words(flash, meta_backup, FLASH_META_DESC_LEN / sizeof(uint32_t));
 
-	// copy storage
-	flash = storage_flash_words(flash, &storage_magic, sizeof(storage_magic) / sizeof(uint32_t));
+	// copy storage, the magic stays erased until everything else is written
+	flash += sizeof(storage_magic);
 	flash = storage_flash_words(flash, storage_uuid, sizeof(storage_uuid) / sizeof(uint32_t));
 
 	if (update) {
 		flash = storage_flash_words(flash, (const uint32_t *)&storageUpdate, sizeof(storageUpdate) / sizeof(uint32_t));
+		storage_ram_load(&storageUpdate);
+	} else {
+		memzero(&storageRam, sizeof(storageRam));
 	}
 	storage_clear_update();
 
-	// fill remainder with zero for future extensions
-	while (flash < FLASH_STORAGE_PINAREA) {
+	// fill remainder of the Storage structure with zero, the storage log stays erased
+	while (flash < FLASH_STORAGE_LOG) {
 		flash_write32(flash, 0);
 		flash += sizeof(uint32_t);
 	}
+	storage_log_end = FLASH_STORAGE_LOG;
+	storage_log_full = false;
+
+	// the magic marks the rewritten storage as valid
+	storage_flash_words(FLASH_STORAGE_START, &storage_magic, sizeof(storage_magic) / sizeof(uint32_t));
+	flash_stats.commit_ms += timer_ms() - start;
 }
 
 void storage_clear_update(void)
 {
 	memzero(&storageUpdate, sizeof(storageUpdate));
+	storage_generation++;
+}
+
+/*
+ * Returns a counter that changes whenever the committed or pending
+ * storage changes, so that things derived from it can be cached.
+ */
+uint32_t storage_getGeneration(void)
+{
+	return storage_generation;
 }
 
 void storage_update(void)
@@ -407,17 +782,17 @@ static void storage_setNode(const HDNodeType *node) {
 
 #if DEBUG_LINK
 void storage_dumpNode(HDNodeType *node) {
-	node->depth = storageRom->node.depth;
-	node->fingerprint = storageRom->node.fingerprint;
-	node->child_num = storageRom->node.child_num;
+	node->depth = storageFlash->node.depth;
+	node->fingerprint = storageFlash->node.fingerprint;
+	node->child_num = storageFlash->node.child_num;
 
 	node->chain_code.size = 32;
-	memcpy(node->chain_code.bytes, storageRom->node.chain_code.bytes, 32);
+	memcpy(node->chain_code.bytes, storageFlash->node.chain_code.bytes, 32);
 
-	if (storageRom->node.has_private_key) {
+	if (storageFlash->node.has_private_key) {
 		node->has_private_key = true;
 		node->private_key.size = 32;
-		memcpy(node->private_key.bytes, storageRom->node.private_key.bytes, 32);
+		memcpy(node->private_key.bytes, storageFlash->node.private_key.bytes, 32);
 	}
 }
 #endif
@@ -480,6 +855,7 @@ void storage_setLanguage(const char *lang)
 
 void storage_setPassphraseProtection(bool passphrase_protection)
 {
+	session_clearPublicKeys();
 	sessionSeedCached = false;
 	sessionPassphraseCached = false;
 
@@ -512,6 +888,11 @@ static void get_root_node_callback(uint32_t iter, uint32_t total)
 
 const uint8_t *storage_getSeed(bool usePassphrase)
 {
+	// without passphrase protection the passphrase is always empty
+	if (!storage_hasPassphraseProtection()) {
+		usePassphrase = false;
+	}
+
 	// root node is properly cached
 	if (usePassphrase == sessionSeedUsesPassphrase
 		&& sessionSeedCached) {
@@ -526,13 +907,13 @@ const uint8_t *storage_getSeed(bool usePassphrase)
 		// if storage was not imported (i.e. it was properly generated or recovered)
 		if (!storageRom->has_imported || !storageRom->imported) {
 			// test whether mnemonic is a valid BIP-0039 mnemonic
-			if (!mnemonic_check(storageRom->mnemonic)) {
+			if (!mnemonic_check(storageFlash->mnemonic)) {
 				// and if not then halt the device
 				storage_show_error();
 			}
 		}
 		char oldTiny = usbTiny(1);
-		mnemonic_to_seed(storageRom->mnemonic, usePassphrase ? sessionPassphrase : "", sessionSeed, get_root_node_callback); // BIP-0039
+		mnemonic_to_seed(storageFlash->mnemonic, usePassphrase ? sessionPassphrase : "", sessionSeed, get_root_node_callback); // BIP-0039
 		usbTiny(oldTiny);
 		sessionSeedCached = true;
 		sessionSeedUsesPassphrase = usePassphrase;
@@ -548,7 +929,7 @@ static bool storage_loadNode(const StorageHDNode *node, const char *curve, HDNod
 
 bool storage_getU2FRoot(HDNode *node)
 {
-	return storageRom->has_u2froot && storage_loadNode(&storageRom->u2froot, NIST256P1_NAME, node);
+	return storageRom->has_u2froot && storage_loadNode(&storageFlash->u2froot, NIST256P1_NAME, node);
 }
 
 bool storage_getRootNode(HDNode *node, const char *curve, bool usePassphrase)
@@ -558,7 +939,7 @@ bool storage_getRootNode(HDNode *node, const char *curve, bool usePassphrase)
 		if (!protectPassphrase()) {
 			return false;
 		}
-		if (!storage_loadNode(&storageRom->node, curve, node)) {
+		if (!storage_loadNode(&storageFlash->node, curve, node)) {
 			return false;
 		}
 		if (storageRom->has_passphrase_protection && storageRom->passphrase_protection && sessionPassphraseCached && strlen(sessionPassphrase) > 0) {
@@ -588,6 +969,115 @@ bool storage_getRootNode(HDNode *node, const char *curve, bool usePassphrase)
 	return hdnode_from_seed(seed, 64, curve, node);
 }
 
+/* Check whether the public node for a path can be kept in the flash
+ * cache: the cache must be enabled by the storage flag, passphrase
+ * protection disabled, since the cached nodes belong to the wallet with
+ * the empty passphrase, and the path must be a standard account path
+ * purpose'/coin_type'/account' of BIP-44, BIP-49 or BIP-84.
+ */
+bool storage_isPublicNodeCacheable(const uint32_t *address_n, size_t address_n_count)
+{
+	if (!(storage_getFlags() & STORAGE_FLAG_XPUB_CACHE)
+		|| !storage_isInitialized() || storage_hasPassphraseProtection()) {
+		return false;
+	}
+	if (address_n_count != STORAGE_XPUB_PATH_LEN) {
+		return false;
+	}
+	for (size_t i = 0; i < address_n_count; i++) {
+		if (!(address_n[i] & 0x80000000)) {
+			return false;
+		}
+	}
+	return address_n[0] == (0x80000000 | 44)
+		|| address_n[0] == (0x80000000 | 49)
+		|| address_n[0] == (0x80000000 | 84);
+}
+
+static bool storage_publicNodeMatches(const StoragePublicNode *entry, const uint32_t *address_n)
+{
+	return entry->magic == storage_xpub_magic
+		&& memcmp(entry->address_n, address_n, sizeof(entry->address_n)) == 0;
+}
+
+/* Look up the public secp256k1 node for an account path in the flash
+ * cache.
+ */
+bool storage_getPublicNode(const uint32_t *address_n, size_t address_n_count, HDNode *node, uint32_t *fingerprint)
+{
+	if (!storage_isPublicNodeCacheable(address_n, address_n_count)) {
+		return false;
+	}
+	for (uint32_t i = 0; i < STORAGE_XPUB_COUNT; i++) {
+		const StoragePublicNode *entry = &storageXpubRom[i];
+		if (storage_publicNodeMatches(entry, address_n)) {
+			if (fingerprint) {
+				*fingerprint = entry->fingerprint;
+			}
+			return hdnode_from_xpub(entry->depth, entry->child_num, entry->chain_code, entry->public_key, SECP256K1_NAME, node) == 1;
+		}
+	}
+	return false;
+}
+
+/* Store the public part of a secp256k1 node in the flash cache.
+ * The public key of the node must be filled in.
+ */
+void storage_setPublicNode(const uint32_t *address_n, size_t address_n_count, const HDNode *node, uint32_t fingerprint)
+{
+	if (!storage_isPublicNodeCacheable(address_n, address_n_count)) {
+		return;
+	}
+
+	// find the first entry that was never written
+	uint32_t i;
+	bool invalidated = false;
+	for (i = 0; i < STORAGE_XPUB_COUNT; i++) {
+		const StoragePublicNode *entry = &storageXpubRom[i];
+		if (storage_publicNodeMatches(entry, address_n)) {
+			return;
+		}
+		if (entry->magic == 0) {
+			invalidated = true;
+			continue;
+		}
+		const uint32_t *words = (const uint32_t *) entry;
+		uint32_t j = 0;
+		while (j < sizeof(StoragePublicNode) / sizeof(uint32_t) && words[j] == 0xffffffff) {
+			j++;
+		}
+		if (j == sizeof(StoragePublicNode) / sizeof(uint32_t)) {
+			break;
+		}
+	}
+	if (i == STORAGE_XPUB_COUNT && !invalidated) {
+		// cache is full of valid entries
+		return;
+	}
+	svc_flash_unlock();
+	if (i == STORAGE_XPUB_COUNT) {
+		// reclaim the invalidated entries by recycling the sector
+		storage_area_recycle(*(const uint32_t*)FLASH_PTR(storage_getPinFailsOffset()));
+		i = 0;
+	}
+
+	StoragePublicNode entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.fingerprint = fingerprint;
+	entry.depth = node->depth;
+	entry.child_num = node->child_num;
+	memcpy(entry.address_n, address_n, sizeof(entry.address_n));
+	memcpy(entry.chain_code, node->chain_code, sizeof(entry.chain_code));
+	memcpy(entry.public_key, node->public_key, 33);
+
+	// write magic last, so that an interrupted write leaves no valid entry
+	uint32_t flash = FLASH_STORAGE_XPUBAREA + i * sizeof(StoragePublicNode);
+	svc_flash_program(FLASH_CR_PROGRAM_X32);
+	storage_flash_words(flash + sizeof(uint32_t), (const uint32_t *)&entry + 1, sizeof(entry) / sizeof(uint32_t) - 1);
+	flash_write32(flash, storage_xpub_magic);
+	storage_check_flash_errors(svc_flash_lock());
+}
+
 const char *storage_getLabel(void)
 {
 	return storageRom->has_label ? storageRom->label : 0;
@@ -622,7 +1112,7 @@ bool storage_hasMnemonic(void)
 const char *storage_getMnemonic(void)
 {
 	return storageUpdate.has_mnemonic ? storageUpdate.mnemonic
-		: storageRom->has_mnemonic ? storageRom->mnemonic : 0;
+		: storageRom->has_mnemonic ? storageFlash->mnemonic : 0;
 }
 
 /* Check whether mnemonic matches storage. The mnemonic must be
@@ -635,9 +1125,9 @@ bool storage_containsMnemonic(const char *mnemonic) {
 	char diff = 0;
 	uint32_t i = 0;
 	for (; mnemonic[i]; i++) {
-		diff |= (storageRom->mnemonic[i] - mnemonic[i]);
+		diff |= (storageFlash->mnemonic[i] - mnemonic[i]);
 	}
-	diff |= storageRom->mnemonic[i];
+	diff |= storageFlash->mnemonic[i];
 	return diff == 0;
 }
 
@@ -652,16 +1142,16 @@ bool storage_containsPin(const char *pin)
 	char diff = 0;
 	uint32_t i = 0;
 	while (pin[i]) {
-		diff |= storageRom->pin[i] - pin[i];
+		diff |= storageFlash->pin[i] - pin[i];
 		i++;
 	}
-	diff |= storageRom->pin[i];
+	diff |= storageFlash->pin[i];
 	return diff == 0;
 }
 
 bool storage_hasPin(void)
 {
-	return storageRom->has_pin && storageRom->pin[0] != 0;
+	return storageRom->has_pin && storageFlash->pin[0] != 0;
 }
 
 void storage_setPin(const char *pin)
@@ -673,7 +1163,7 @@ void storage_setPin(const char *pin)
 
 const char *storage_getPin(void)
 {
-	return storageRom->has_pin ? storageRom->pin : 0;
+	return storageRom->has_pin ? storageFlash->pin : 0;
 }
 
 void session_cachePassphrase(const char *passphrase)
@@ -714,6 +1204,48 @@ bool session_getState(const uint8_t *salt, uint8_t *state, const char *passphras
 	return true;
 }
 
+bool session_getPublicKey(const char *curve, const uint32_t *address_n, size_t address_n_count, uint8_t *public_key)
+{
+	const curve_info *info = get_curve_by_name(curve);
+	if (!info || address_n_count > SESSION_PUBKEY_MAX_PATH) {
+		return false;
+	}
+	for (int i = 0; i < SESSION_PUBKEY_CACHE_SIZE; i++) {
+		if (sessionPublicKeys[i].set && sessionPublicKeys[i].curve == info
+			&& sessionPublicKeys[i].address_n_count == address_n_count
+			&& memcmp(sessionPublicKeys[i].address_n, address_n, address_n_count * sizeof(uint32_t)) == 0) {
+			sessionPublicKeys[i].last_use = ++sessionPublicKeysUse;
+			memcpy(public_key, sessionPublicKeys[i].public_key, sizeof(sessionPublicKeys[i].public_key));
+			return true;
+		}
+	}
+	return false;
+}
+
+void session_cachePublicKey(const char *curve, const uint32_t *address_n, size_t address_n_count, const uint8_t *public_key)
+{
+	const curve_info *info = get_curve_by_name(curve);
+	if (!info || address_n_count > SESSION_PUBKEY_MAX_PATH) {
+		return;
+	}
+	// replace the least recently used entry
+	int lru = 0;
+	for (int i = 1; i < SESSION_PUBKEY_CACHE_SIZE; i++) {
+		if (!sessionPublicKeys[lru].set) {
+			break;
+		}
+		if (!sessionPublicKeys[i].set || sessionPublicKeys[i].last_use < sessionPublicKeys[lru].last_use) {
+			lru = i;
+		}
+	}
+	sessionPublicKeys[lru].set = true;
+	sessionPublicKeys[lru].last_use = ++sessionPublicKeysUse;
+	sessionPublicKeys[lru].curve = info;
+	sessionPublicKeys[lru].address_n_count = address_n_count;
+	memcpy(sessionPublicKeys[lru].address_n, address_n, address_n_count * sizeof(uint32_t));
+	memcpy(sessionPublicKeys[lru].public_key, public_key, sizeof(sessionPublicKeys[lru].public_key));
+}
+
 void session_cachePin(void)
 {
 	sessionPinCached = true;
@@ -724,12 +1256,63 @@ bool session_isPinCached(void)
 	return sessionPinCached;
 }
 
+#if EMULATOR
+
+/* Session state saved together with the emulator flash snapshots, so
+ * that a restored snapshot continues with the same unlocked session.
+ */
+static struct {
+	bool saved;
+	bool seedCached, seedUsesPassphrase, pinCached, passphraseCached;
+	uint8_t seed[sizeof(sessionSeed)];
+	char passphrase[sizeof(sessionPassphrase)];
+	uint8_t publicKeys[sizeof(sessionPublicKeys)];
+	uint32_t publicKeysUse;
+} sessionSnapshots[EMULATOR_SNAPSHOT_SLOTS];
+
+bool session_snapshot(uint32_t slot)
+{
+	if (slot >= EMULATOR_SNAPSHOT_SLOTS) {
+		return false;
+	}
+	sessionSnapshots[slot].saved = true;
+	sessionSnapshots[slot].seedCached = sessionSeedCached;
+	sessionSnapshots[slot].seedUsesPassphrase = sessionSeedUsesPassphrase;
+	sessionSnapshots[slot].pinCached = sessionPinCached;
+	sessionSnapshots[slot].passphraseCached = sessionPassphraseCached;
+	memcpy(sessionSnapshots[slot].seed, sessionSeed, sizeof(sessionSeed));
+	memcpy(sessionSnapshots[slot].passphrase, sessionPassphrase, sizeof(sessionPassphrase));
+	memcpy(sessionSnapshots[slot].publicKeys, sessionPublicKeys, sizeof(sessionPublicKeys));
+	sessionSnapshots[slot].publicKeysUse = sessionPublicKeysUse;
+	return true;
+}
+
+bool session_restore(uint32_t slot)
+{
+	if (slot >= EMULATOR_SNAPSHOT_SLOTS || !sessionSnapshots[slot].saved) {
+		return false;
+	}
+	sessionSeedCached = sessionSnapshots[slot].seedCached;
+	sessionSeedUsesPassphrase = sessionSnapshots[slot].seedUsesPassphrase;
+	sessionPinCached = sessionSnapshots[slot].pinCached;
+	sessionPassphraseCached = sessionSnapshots[slot].passphraseCached;
+	memcpy(sessionSeed, sessionSnapshots[slot].seed, sizeof(sessionSeed));
+	memcpy(sessionPassphrase, sessionSnapshots[slot].passphrase, sizeof(sessionPassphrase));
+	memcpy(sessionPublicKeys, sessionSnapshots[slot].publicKeys, sizeof(sessionPublicKeys));
+	sessionPublicKeysUse = sessionSnapshots[slot].publicKeysUse;
+	return true;
+}
+
+#endif
+
 void storage_clearPinArea(void)
 {
 	svc_flash_unlock();
 	svc_flash_erase_sector(FLASH_META_SECTOR_LAST);
 	storage_check_flash_errors(svc_flash_lock());
 	storage_u2f_offset = 0;
+	storage_u2f_segment = 0;
+	storage_u2f_bits = 0;
 }
 
 // called when u2f area or pin area overflows
@@ -751,9 +1334,14 @@ static void storage_area_recycle(uint32_t new_pinfails)
 	}
 
 	// restore storage sector
-	storageUpdate.has_u2f_counter = true;
+	if (!storageUpdate.has_u2f_counter) {
+		storageUpdate.has_u2f_counter = true;
+		storageUpdate.u2f_counter = storageRom->u2f_counter;
+	}
 	storageUpdate.u2f_counter += storage_u2f_offset;
 	storage_u2f_offset = 0;
+	storage_u2f_segment = 0;
+	storage_u2f_bits = 0;
 	storage_commit_locked(true);
 }
 
@@ -828,6 +1416,7 @@ void storage_setNeedsBackup(bool needs_backup)
 {
 	storageUpdate.has_needs_backup = true;
 	storageUpdate.needs_backup = needs_backup;
+	storage_generation++;
 }
 
 bool storage_unfinishedBackup(void)
@@ -840,6 +1429,7 @@ void storage_setUnfinishedBackup(bool unfinished_backup)
 {
 	storageUpdate.has_unfinished_backup = true;
 	storageUpdate.unfinished_backup = unfinished_backup;
+	storage_generation++;
 }
 
 void storage_applyFlags(uint32_t flags)
@@ -858,18 +1448,25 @@ uint32_t storage_getFlags(void)
 
 uint32_t storage_nextU2FCounter(void)
 {
-	uint32_t flash_u2f_offset = FLASH_STORAGE_U2FAREA +
-		sizeof(uint32_t) * (storage_u2f_offset / 32);
-	uint32_t newval = 0xfffffffe << (storage_u2f_offset & 31);
-
 	svc_flash_unlock();
-	svc_flash_program(FLASH_CR_PROGRAM_X32);
-	flash_write32(flash_u2f_offset, newval);
-	storage_u2f_offset++;
-	if (storage_u2f_offset >= 8 * FLASH_STORAGE_U2FAREA_LEN) {
+	if (storage_u2f_bits >= STORAGE_U2FSEGMENT_BITS) {
+		// all segments are full
 		storage_area_recycle(*(const uint32_t*)
 							 FLASH_PTR(storage_getPinFailsOffset()));
 	}
+	svc_flash_program(FLASH_CR_PROGRAM_X32);
+	uint32_t segment = FLASH_STORAGE_U2FAREA + storage_u2f_segment * FLASH_STORAGE_U2FSEGMENT_LEN;
+	if (*(const uint32_t *)FLASH_PTR(segment) == 0xffffffff) {
+		// start the segment at the current offset
+		flash_write32(segment, storage_u2f_offset);
+	}
+	uint32_t flash_u2f_offset = segment + sizeof(uint32_t) +
+		sizeof(uint32_t) * (storage_u2f_bits / 32);
+	uint32_t newval = 0xfffffffe << (storage_u2f_bits & 31);
+	flash_write32(flash_u2f_offset, newval);
+	storage_u2f_bits++;
+	storage_u2f_offset++;
+	storage_u2f_advance();
 	storage_check_flash_errors(svc_flash_lock());
 	return storageRom->u2f_counter + storage_u2f_offset;
 }
@@ -78,11 +78,25 @@ typedef struct _Storage {
 
 extern Storage storageUpdate;
 
+/* Storage flag (set with ApplyFlags) that enables the flash cache of
+ * public account nodes.  Like all flags it is only cleared by a wipe.
+ */
+#define STORAGE_FLAG_XPUB_CACHE 0x80000000
+
+/* The public node cache only holds BIP-44/49/84 account nodes. */
+#define STORAGE_XPUB_PATH_LEN 3
+#define SESSION_PUBKEY_MAX_PATH 8
+
 void storage_init(void);
 void storage_generate_uuid(void);
 void storage_clear_update(void);
 void storage_update(void);
+uint32_t storage_getGeneration(void);
 void session_clear(bool clear_pin);
+#if EMULATOR
+bool session_snapshot(uint32_t slot);
+bool session_restore(uint32_t slot);
+#endif
 
 void storage_loadDevice(LoadDevice *msg);
 
@@ -91,6 +105,10 @@ const uint8_t *storage_getSeed(bool usePassphrase);
 bool storage_getU2FRoot(HDNode *node);
 bool storage_getRootNode(HDNode *node, const char *curve, bool usePassphrase);
 
+bool storage_isPublicNodeCacheable(const uint32_t *address_n, size_t address_n_count);
+bool storage_getPublicNode(const uint32_t *address_n, size_t address_n_count, HDNode *node, uint32_t *fingerprint);
+void storage_setPublicNode(const uint32_t *address_n, size_t address_n_count, const HDNode *node, uint32_t fingerprint);
+
 const char *storage_getLabel(void);
 void storage_setLabel(const char *label);
 
@@ -107,6 +125,9 @@ void session_cachePassphrase(const char *passphrase);
 bool session_isPassphraseCached(void);
 bool session_getState(const uint8_t *salt, uint8_t *state, const char *passphrase);
 
+bool session_getPublicKey(const char *curve, const uint32_t *address_n, size_t address_n_count, uint8_t *public_key);
+void session_cachePublicKey(const char *curve, const uint32_t *address_n, size_t address_n_count, const uint8_t *public_key);
+
 void storage_setMnemonic(const char *mnemonic);
 bool storage_containsMnemonic(const char *mnemonic);
 bool storage_hasMnemonic(void);
@@ -31,6 +31,7 @@
 #include "buttons.h"
 #include "gettext.h"
 #include "bl_check.h"
+#include "fsm.h"
 
 /* Screen timeout */
 uint32_t system_millis_lock_start;
@@ -112,6 +113,7 @@ int main(void)
 	oledRefresh();
 
 	storage_init();
+	fsm_initFeatures();
 	layoutHome();
 	usbInit();
 	for (;;) {
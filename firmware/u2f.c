@@ -33,6 +33,7 @@
 #include "hmac.h"
 #include "util.h"
 #include "gettext.h"
+#include "arena.h"
 
 #include "u2f/u2f.h"
 #include "u2f/u2f_hid.h"
@@ -47,7 +48,8 @@
 // Initialise without a cid
 static uint32_t cid = 0;
 
-// Circular Output buffer
+// Circular Output buffer, drained by the USB poll after the request is
+// done, so it stays outside of the arena like msg_out
 static uint32_t u2f_out_start = 0;
 static uint32_t u2f_out_end = 0;
 static uint8_t u2f_out_packets[U2F_OUT_PKT_BUFFER_LEN][HID_RPT_SIZE];
@@ -108,6 +110,8 @@ typedef struct {
 	uint8_t cmd;
 } U2F_ReadBuffer;
 
+_Static_assert(sizeof(U2F_ReadBuffer) <= ARENA_SIZE, "U2F_ReadBuffer does not fit into the arena");
+
 U2F_ReadBuffer *reader;
 
 void u2fhid_read(char tiny, const U2FHID_FRAME *f)
@@ -168,7 +172,6 @@ void u2fhid_init_cmd(const U2FHID_FRAME *f) {
 }
 
 void u2fhid_read_start(const U2FHID_FRAME *f) {
-	U2F_ReadBuffer readbuffer;
 	if (!(f->type & TYPE_INIT)) {
 		return;
 	}
@@ -184,7 +187,16 @@ void u2fhid_read_start(const U2FHID_FRAME *f) {
 		return;
 	}
 
-	reader = &readbuffer;
+	reader = arena_alloc(sizeof(U2F_ReadBuffer));
+	if (!reader) {
+		// a message the host stopped sending halfway must not block U2F
+		msg_read_abort();
+		reader = arena_alloc(sizeof(U2F_ReadBuffer));
+	}
+	if (!reader) { // a message is being processed
+		send_u2fhid_error(f->cid, ERR_CHANNEL_BUSY);
+		return;
+	}
 	u2fhid_init_cmd(f);
 
 	usbTiny(1);
@@ -199,6 +211,7 @@ void u2fhid_read_start(const U2FHID_FRAME *f) {
 					// timeout
 					send_u2fhid_error(cid, ERR_MSG_TIMEOUT);
 					cid = 0;
+					arena_release(reader);
 					reader = 0;
 					usbTiny(0);
 					layoutHome();
@@ -245,6 +258,7 @@ void u2fhid_read_start(const U2FHID_FRAME *f) {
 		if (reader->cmd == 0) {
 			last_req_state = INIT;
 			cid = 0;
+			arena_release(reader);
 			reader = 0;
 			usbTiny(0);
 			layoutHome();
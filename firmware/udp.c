@@ -71,6 +71,13 @@ char usbTiny(char set) {
 }
 
 void usbSleep(uint32_t millis) {
+	if (emulatorClockIsVirtual()) {
+		// the virtual clock only moves when the host advances it, so
+		// polling loops do not burn time while waiting for the host
+		usbPoll();
+		return;
+	}
+
 	uint32_t start = timer_ms();
 
 	while ((timer_ms() - start) < millis) {
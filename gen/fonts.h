@@ -8,6 +8,9 @@
 #define FONT_FIXED    1
 #define FONT_DOUBLE   0x80
 
+/* Every glyph starts with its width, followed by one byte per column;
+ * the MSB of a column is its top most pixel, like in the display pages.
+ */
 extern const uint8_t * const font_data[2][128];
 
 int fontCharWidth(int font, char c);
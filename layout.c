@@ -92,25 +92,54 @@ void layoutProgressUpdate(bool refresh)
 	}
 }
 
+/*
+ * Shows desc above a progress bar.  While the progress screen drawn last
+ * is still shown with the same desc, only the changed part of the bar
+ * and the gears are drawn again, so that it is cheap to call in loops.
+ */
 void layoutProgress(const char *desc, int permil)
 {
-	oledClear();
-	layoutProgressUpdate(false);
-	// progressbar
-	oledFrame(0, OLED_HEIGHT - 8, OLED_WIDTH - 1, OLED_HEIGHT - 1);
-	oledBox(1, OLED_HEIGHT - 7, OLED_WIDTH - 2, OLED_HEIGHT - 2, 0);
-	permil = permil * (OLED_WIDTH - 4) / 1000;
-	if (permil < 0) {
-		permil = 0;
+	static bool drawn = false;
+	static uint32_t drawn_generation;
+	static char drawn_desc[32];
+	static size_t drawn_desc_len;
+	static int drawn_bar;
+
+	int bar = permil * (OLED_WIDTH - 4) / 1000;
+	if (bar < 0) {
+		bar = 0;
 	}
-	if (permil > OLED_WIDTH - 4) {
-		permil = OLED_WIDTH - 4;
+	if (bar > OLED_WIDTH - 4) {
+		bar = OLED_WIDTH - 4;
 	}
-	oledBox(2, OLED_HEIGHT - 6, 1 + permil, OLED_HEIGHT - 3, 1);
-	// text
-	oledBox(0, OLED_HEIGHT - 16, OLED_WIDTH - 1, OLED_HEIGHT - 16 + 7, 0);
-	if (desc) {
+	if (!desc) {
+		desc = "";
+	}
+
+	// drawn_desc keeps a prefix of longer descriptions, compare the length too
+	size_t desc_len = strlen(desc);
+	if (drawn && drawn_generation == oledGeneration() && desc_len == drawn_desc_len && strncmp(desc, drawn_desc, sizeof(drawn_desc) - 1) == 0) {
+		layoutProgressUpdate(false);
+		if (bar > drawn_bar) {
+			oledBox(2 + drawn_bar, OLED_HEIGHT - 6, 1 + bar, OLED_HEIGHT - 3, 1);
+		} else if (bar < drawn_bar) {
+			oledBox(2 + bar, OLED_HEIGHT - 6, 1 + drawn_bar, OLED_HEIGHT - 3, 0);
+		}
+	} else {
+		oledClear();
+		layoutProgressUpdate(false);
+		// progressbar
+		oledFrame(0, OLED_HEIGHT - 8, OLED_WIDTH - 1, OLED_HEIGHT - 1);
+		oledBox(1, OLED_HEIGHT - 7, OLED_WIDTH - 2, OLED_HEIGHT - 2, 0);
+		oledBox(2, OLED_HEIGHT - 6, 1 + bar, OLED_HEIGHT - 3, 1);
+		// text
+		oledBox(0, OLED_HEIGHT - 16, OLED_WIDTH - 1, OLED_HEIGHT - 16 + 7, 0);
 		oledDrawStringCenter(OLED_HEIGHT - 16, desc, FONT_STANDARD);
+		drawn = true;
+		drawn_generation = oledGeneration();
+		strlcpy(drawn_desc, desc, sizeof(drawn_desc));
+		drawn_desc_len = desc_len;
 	}
+	drawn_bar = bar;
 	oledRefresh();
 }
@@ -25,6 +25,8 @@
 #define FLASH_OPTION_BYTES_1 (*(const uint64_t *)0x1FFFC000)
 #define FLASH_OPTION_BYTES_2 (*(const uint64_t *)0x1FFFC008)
 
+FlashStats flash_stats;
+
 void memory_protect(void)
 {
 #if MEMORY_PROTECT
@@ -73,3 +75,31 @@ int memory_bootloader_hash(uint8_t *hash)
 	sha256_Raw(hash, 32, hash);
 	return 32;
 }
+
+uint32_t flash_write_words(uint32_t addr, const uint32_t *src, uint32_t nwords)
+{
+	while (nwords--) {
+		flash_write32(addr, *src++);
+		addr += sizeof(uint32_t);
+	}
+	return addr;
+}
+
+#if !EMULATOR
+
+uint32_t flash_program_words(uint32_t addr, const uint32_t *src, uint32_t nwords)
+{
+	// 64-bit parallelism needs an external VPP supply, so 32-bit is
+	// the widest program size available in our voltage range
+	flash_wait_for_last_operation();
+	FLASH_CR = (FLASH_CR & ~(FLASH_CR_PROGRAM_MASK << FLASH_CR_PROGRAM_SHIFT))
+		| (FLASH_CR_PROGRAM_X32 << FLASH_CR_PROGRAM_SHIFT);
+	FLASH_CR |= FLASH_CR_PG;
+	// the bus is stalled while the previous word is programmed
+	flash_write_words(addr, src, nwords);
+	flash_wait_for_last_operation();
+	FLASH_CR &= ~FLASH_CR_PG;
+	return FLASH_SR;
+}
+
+#endif
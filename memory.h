@@ -111,11 +111,49 @@ void memory_protect(void);
 void memory_write_unlock(void);
 int memory_bootloader_hash(uint8_t *hash);
 
+/* Flash usage statistics, kept in RAM since boot.  commit_ms is measured
+ * with timer_ms and includes the sector erases of full storage rewrites,
+ * the erase SVC moves the millisecond counter on by the time it took.
+ */
+typedef struct {
+	uint32_t erase_count;   // sectors erased
+	uint32_t erase_us;      // cumulative erase time in microseconds
+	uint32_t program_count; // words programmed
+	uint32_t commit_count;  // storage commits
+	uint32_t commit_ms;     // cumulative storage commit time in milliseconds, erases included
+} FlashStats;
+
+extern FlashStats flash_stats;
+
+#if EMULATOR
+// programming can only clear bits, like on the device
+inline void flash_write32(uint32_t addr, uint32_t word) {
+	*(volatile uint32_t *) FLASH_PTR(addr) &= word;
+	flash_stats.program_count++;
+}
+inline void flash_write8(uint32_t addr, uint8_t byte) {
+	*(volatile uint8_t *) FLASH_PTR(addr) &= byte;
+}
+#else
 inline void flash_write32(uint32_t addr, uint32_t word) {
 	*(volatile uint32_t *) FLASH_PTR(addr) = word;
+	flash_stats.program_count++;
 }
 inline void flash_write8(uint32_t addr, uint8_t byte) {
 	*(volatile uint8_t *) FLASH_PTR(addr) = byte;
 }
+#endif
+
+/* Writes a span of words to flash, programming must already be enabled
+ * for 32-bit words (svc_flash_program(FLASH_CR_PROGRAM_X32)).
+ * @return address after the last word written
+ */
+uint32_t flash_write_words(uint32_t addr, const uint32_t *src, uint32_t nwords);
+
+/* Programs a span of words to flash, the flash must be unlocked.
+ * Only waits for the flash controller before and after the span.
+ * @return flash status register (FLASH_SR)
+ */
+uint32_t flash_program_words(uint32_t addr, const uint32_t *src, uint32_t nwords);
 
 #endif
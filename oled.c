@@ -46,6 +46,8 @@
 #define OLED_COMSCANDEC			0xC8
 #define OLED_SEGREMAP			0xA0
 #define OLED_CHARGEPUMP			0x8D
+#define OLED_SETCOLUMNADDR		0x21
+#define OLED_SETPAGEADDR		0x22
 
 #define SPI_BASE			SPI1
 #define OLED_DC_PORT			GPIOB
@@ -66,12 +68,48 @@
 static uint8_t _oledbuffer[OLED_BUFSIZE];
 static bool is_debug_link = 0;
 
+/* The drawing functions record for every page of _oledbuffer the span
+ * of columns they changed since the last refresh.  The refresh compares
+ * these spans with the contents sent last time (_oledsent) and only
+ * sends the parts that really differ.
+ */
+static uint8_t _oledsent[OLED_BUFSIZE];
+static bool _oledsent_valid = false;
+static uint8_t _oleddirty_start[OLED_HEIGHT / 8];
+static uint8_t _oleddirty_end[OLED_HEIGHT / 8] = { [0 ... OLED_HEIGHT / 8 - 1] = OLED_WIDTH - 1 };
+static uint32_t _oledgeneration = 0;
+
 /*
  * macros to convert coordinate to bit position
  */
 #define OLED_OFFSET(x, y) (OLED_BUFSIZE - 1 - (x) - ((y)/8)*OLED_WIDTH)
 #define OLED_MASK(x, y)   (1 << (7 - (y) % 8))
 
+/*
+ * Marks the byte at offset of _oledbuffer as changed
+ */
+static inline void oledDirty(int offset)
+{
+	int page = offset / OLED_WIDTH;
+	int col = offset % OLED_WIDTH;
+	if (col < _oleddirty_start[page]) {
+		_oleddirty_start[page] = col;
+	}
+	if (col > _oleddirty_end[page]) {
+		_oleddirty_end[page] = col;
+	}
+}
+
+/*
+ * Marks the whole _oledbuffer as changed
+ */
+static void oledDirtyAll(void)
+{
+	memset(_oleddirty_start, 0, sizeof(_oleddirty_start));
+	memset(_oleddirty_end, OLED_WIDTH - 1, sizeof(_oleddirty_end));
+	_oledgeneration++;
+}
+
 /*
  * Draws a white pixel at x, y
  */
@@ -81,6 +119,7 @@ void oledDrawPixel(int x, int y)
 		return;
 	}
 	_oledbuffer[OLED_OFFSET(x, y)] |= OLED_MASK(x, y);
+	oledDirty(OLED_OFFSET(x, y));
 }
 
 /*
@@ -92,6 +131,7 @@ void oledClearPixel(int x, int y)
 		return;
 	}
 	_oledbuffer[OLED_OFFSET(x, y)] &= ~OLED_MASK(x, y);
+	oledDirty(OLED_OFFSET(x, y));
 }
 
 /*
@@ -103,6 +143,7 @@ void oledInvertPixel(int x, int y)
 		return;
 	}
 	_oledbuffer[OLED_OFFSET(x, y)] ^= OLED_MASK(x, y);
+	oledDirty(OLED_OFFSET(x, y));
 }
 
 #if !EMULATOR
@@ -178,6 +219,7 @@ void oledInit()
 void oledClear()
 {
 	memset(_oledbuffer, 0, sizeof(_oledbuffer));
+	oledDirtyAll();
 }
 
 void oledInvertDebugLink()
@@ -192,28 +234,63 @@ void oledInvertDebugLink()
 }
 
 /*
- * Refresh the display. This copies the buffer to the display to show the
- * contents.  This must be called after every operation to the buffer to
- * make the change visible.  All other operations only change the buffer
- * not the content of the display.
+ * Calls send for every page of the buffer that changed since the last
+ * call, with the first changed column and the changed bytes.
  */
-#if !EMULATOR
-void oledRefresh()
+void oledRefreshPages(void (*send)(int page, int col, const uint8_t *data, int len))
 {
-	static const uint8_t s[3] = {OLED_SETLOWCOLUMN | 0x00, OLED_SETHIGHCOLUMN | 0x00, OLED_SETSTARTLINE | 0x00};
+	for (int page = 0; page < OLED_HEIGHT / 8; page++) {
+		const uint8_t *data = _oledbuffer + page * OLED_WIDTH;
+		uint8_t *sent = _oledsent + page * OLED_WIDTH;
+		int start = _oleddirty_start[page];
+		int end = _oleddirty_end[page];
+		if (_oledsent_valid) {
+			while (start <= end && data[start] == sent[start]) {
+				start++;
+			}
+			while (end >= start && data[end] == sent[end]) {
+				end--;
+			}
+		}
+		if (start <= end) {
+			send(page, start, data + start, end - start + 1);
+			memcpy(sent + start, data + start, end - start + 1);
+		}
+		_oleddirty_start[page] = OLED_WIDTH;
+		_oleddirty_end[page] = 0;
+	}
+	_oledsent_valid = true;
+}
 
-	// draw triangle in upper right corner
-	oledInvertDebugLink();
+#if !EMULATOR
+static void oledSendPage(int page, int col, const uint8_t *data, int len)
+{
+	const uint8_t s[6] = {OLED_SETCOLUMNADDR, col, col + len - 1, OLED_SETPAGEADDR, page, page};
 
 	gpio_clear(OLED_CS_PORT, OLED_CS_PIN);		// SPI select
-	SPISend(SPI_BASE, s, 3);
+	SPISend(SPI_BASE, s, 6);
 	gpio_set(OLED_CS_PORT, OLED_CS_PIN);		// SPI deselect
 
 	gpio_set(OLED_DC_PORT, OLED_DC_PIN);		// set to DATA
 	gpio_clear(OLED_CS_PORT, OLED_CS_PIN);		// SPI select
-	SPISend(SPI_BASE, _oledbuffer, sizeof(_oledbuffer));
+	SPISend(SPI_BASE, data, len);
 	gpio_set(OLED_CS_PORT, OLED_CS_PIN);		// SPI deselect
 	gpio_clear(OLED_DC_PORT, OLED_DC_PIN);		// set to CMD
+}
+
+/*
+ * Refresh the display. This copies the buffer to the display to show the
+ * contents.  This must be called after every operation to the buffer to
+ * make the change visible.  All other operations only change the buffer
+ * not the content of the display.  Only the changed parts of the display
+ * are transmitted.
+ */
+void oledRefresh()
+{
+	// draw triangle in upper right corner
+	oledInvertDebugLink();
+
+	oledRefreshPages(oledSendPage);
 
 	// return it back
 	oledInvertDebugLink();
@@ -225,6 +302,16 @@ const uint8_t *oledGetBuffer()
 	return _oledbuffer;
 }
 
+/*
+ * Returns a counter that changes whenever the whole buffer is replaced
+ * (cleared, set or swiped).  Layouts use it to find out whether the
+ * screen they drew last is still shown and can be updated in place.
+ */
+uint32_t oledGeneration(void)
+{
+	return _oledgeneration;
+}
+
 void oledSetDebugLink(bool set)
 {
 	is_debug_link = set;
@@ -234,10 +321,43 @@ void oledSetDebugLink(bool set)
 void oledSetBuffer(uint8_t *buf)
 {
 	memcpy(_oledbuffer, buf, sizeof(_oledbuffer));
+	oledDirtyAll();
 }
 
+/*
+ * Draws a column of up to 32 pixels at x, starting at row y.
+ * Bit 31 of bits is the top most pixel.
+ */
+static void oledDrawColumn(int x, int y, uint32_t bits)
+{
+	if (x < 0 || x >= OLED_WIDTH || y <= -32) {
+		return;
+	}
+	if (y < 0) {
+		bits <<= -y;
+		y = 0;
+	}
+	bits >>= y % 8;
+	for (int page = y / 8; bits && page < OLED_HEIGHT / 8; page++, bits <<= 8) {
+		int offset = OLED_OFFSET(x, page * 8);
+		_oledbuffer[offset] |= bits >> 24;
+		oledDirty(offset);
+	}
+}
+
+/*
+ * The glyph columns of the fonts have the top most pixel in the MSB,
+ * which is the bit order of the display pages, so each glyph column is
+ * ORed into at most two bytes of the buffer (three for FONT_DOUBLE).
+ */
 void oledDrawChar(int x, int y, char c, int font)
 {
+	// every bit of a nibble doubled
+	static const uint8_t double_bits[16] = {
+		0x00, 0x03, 0x0C, 0x0F, 0x30, 0x33, 0x3C, 0x3F,
+		0xC0, 0xC3, 0xCC, 0xCF, 0xF0, 0xF3, 0xFC, 0xFF,
+	};
+
 	if (x >= OLED_WIDTH || y >= OLED_HEIGHT || y <= -FONT_HEIGHT) {
 		return;
 	}
@@ -251,14 +371,13 @@ void oledDrawChar(int x, int y, char c, int font)
 	}
 
 	for (int xo = 0; xo < char_width; xo++) {
-		for (int yo = 0; yo < FONT_HEIGHT; yo++) {
-			if (char_data[xo] & (1 << (FONT_HEIGHT - 1 - yo))) {
-				if (zoom <= 1) {
-					oledDrawPixel(x + xo, y + yo);
-				} else {
-					oledBox(x + xo * zoom, y + yo * zoom, x + (xo + 1) * zoom - 1, y + (yo + 1) * zoom - 1, true);
-				}
-			}
+		if (zoom <= 1) {
+			oledDrawColumn(x + xo, y, (uint32_t)char_data[xo] << 24);
+		} else {
+			uint32_t bits = (uint32_t)double_bits[char_data[xo] >> 4] << 24
+				| (uint32_t)double_bits[char_data[xo] & 0x0F] << 16;
+			oledDrawColumn(x + xo * 2, y, bits);
+			oledDrawColumn(x + xo * 2 + 1, y, bits);
 		}
 	}
 }
@@ -314,6 +433,31 @@ void oledDrawStringRight(int x, int y, const char* text, int font)
 
 void oledDrawBitmap(int x, int y, const BITMAP *bmp)
 {
+	if (y % 8 == 0 && bmp->height % 8 == 0) {
+		// page aligned: assemble and store whole column bytes
+		for (int i = 0; i < bmp->width; i++) {
+			if (x + i < 0 || x + i >= OLED_WIDTH) {
+				continue;
+			}
+			const uint8_t *data = bmp->data + i / 8;
+			uint8_t mask = 1 << (7 - i % 8);
+			for (int j = 0; j < bmp->height; j += 8) {
+				if (y + j < 0 || y + j >= OLED_HEIGHT) {
+					continue;
+				}
+				uint8_t column = 0;
+				for (int k = 0; k < 8; k++) {
+					if (data[(j + k) * bmp->width / 8] & mask) {
+						column |= 0x80 >> k;
+					}
+				}
+				int offset = OLED_OFFSET(x + i, y + j);
+				_oledbuffer[offset] = column;
+				oledDirty(offset);
+			}
+		}
+		return;
+	}
 	for (int i = 0; i < bmp->width; i++) {
 		for (int j = 0; j < bmp->height; j++) {
 			if (bmp->data[(i / 8) + j * bmp->width / 8] & (1 << (7 - i % 8))) {
@@ -325,6 +469,28 @@ void oledDrawBitmap(int x, int y, const BITMAP *bmp)
 	}
 }
 
+/*
+ * Copies whole display pages: for each of the pages starting at page,
+ * data holds width bytes for the columns starting at x, with the top
+ * most pixel of every column byte in the MSB.
+ */
+void oledDrawPages(int x, int page, int width, int pages, const uint8_t *data)
+{
+	for (int p = 0; p < pages; p++, data += width) {
+		if (page + p < 0 || page + p >= OLED_HEIGHT / 8) {
+			continue;
+		}
+		for (int i = 0; i < width; i++) {
+			if (x + i < 0 || x + i >= OLED_WIDTH) {
+				continue;
+			}
+			int offset = OLED_OFFSET(x + i, (page + p) * 8);
+			_oledbuffer[offset] = data[i];
+			oledDirty(offset);
+		}
+	}
+}
+
 /*
  * Inverts box between (x1,y1) and (x2,y2) inclusive.
  */
@@ -394,6 +560,7 @@ void oledSwipeLeft(void)
 			}
 			_oledbuffer[j * OLED_WIDTH] = 0;
 		}
+		oledDirtyAll();
 		oledRefresh();
 	}
 }
@@ -417,6 +584,7 @@ void oledSwipeRight(void)
 			_oledbuffer[j * OLED_WIDTH + OLED_WIDTH - 3] = 0;
 			_oledbuffer[j * OLED_WIDTH + OLED_WIDTH - 4] = 0;
 		}
+		oledDirtyAll();
 		oledRefresh();
 	}
 }
@@ -33,12 +33,14 @@
 void oledInit(void);
 void oledClear(void);
 void oledRefresh(void);
+void oledRefreshPages(void (*send)(int page, int col, const uint8_t *data, int len));
 
 void oledSetDebugLink(bool set);
 void oledInvertDebugLink(void);
 
 void oledSetBuffer(uint8_t *buf);
 const uint8_t *oledGetBuffer(void);
+uint32_t oledGeneration(void);
 void oledDrawPixel(int x, int y);
 void oledClearPixel(int x, int y);
 void oledInvertPixel(int x, int y);
@@ -49,6 +51,7 @@ void oledDrawString(int x, int y, const char* text, int font);
 void oledDrawStringCenter(int y, const char* text, int font);
 void oledDrawStringRight(int x, int y, const char* text, int font);
 void oledDrawBitmap(int x, int y, const BITMAP *bmp);
+void oledDrawPages(int x, int page, int width, int pages, const uint8_t *data);
 void oledInvert(int x1, int y1, int x2, int y2);
 void oledBox(int x1, int y1, int x2, int y2, bool set);
 void oledHLine(int y);
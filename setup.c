@@ -17,6 +17,7 @@
  * along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <libopencm3/cm3/dwt.h>
 #include <libopencm3/cm3/mpu.h>
 #include <libopencm3/cm3/nvic.h>
 #include <libopencm3/cm3/scb.h>
@@ -88,6 +89,9 @@ void setup(void)
 	// enable CSS (Clock Security System)
 	RCC_CR |= RCC_CR_CSSON;
 
+	// enable the cycle counter used to time flash erases
+	dwt_enable_cycle_counter();
+
 	// set GPIO for buttons
 	gpio_mode_setup(GPIOC, GPIO_MODE_INPUT, GPIO_PUPD_PULLUP, GPIO2 | GPIO5);
 
@@ -133,6 +137,10 @@ void setupApp(void)
 	// enable CSS (Clock Security System)
 	RCC_CR |= RCC_CR_CSSON;
 
+	// enable the cycle counter used to time flash erases, this needs
+	// access to the PPB that mpu_config takes away later
+	dwt_enable_cycle_counter();
+
 	// hotfix for old bootloader
 	gpio_mode_setup(GPIOA, GPIO_MODE_INPUT, GPIO_PUPD_NONE, GPIO9);
 	spi_init_master(SPI1, SPI_CR1_BAUDRATE_FPCLK_DIV_8, SPI_CR1_CPOL_CLK_TO_0_WHEN_IDLE, SPI_CR1_CPHA_CLK_TRANSITION_1, SPI_CR1_DFF_8BIT, SPI_CR1_MSBFIRST);
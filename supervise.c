@@ -18,7 +18,9 @@
  */
 
 #include <libopencm3/stm32/flash.h>
+#include <libopencm3/cm3/dwt.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include "supervise.h"
 #include "memory.h"
 
@@ -43,13 +45,54 @@ static void svhandler_flash_program(uint32_t psize) {
 	FLASH_CR |= FLASH_CR_PG;
 }
 
+extern volatile uint32_t system_millis;
+
 static void svhandler_flash_erase_sector(uint16_t sector) {
 	/* we only allow erasing meta sectors 2 and 3. */
 	if (sector < FLASH_META_SECTOR_FIRST ||
 		sector > FLASH_META_SECTOR_LAST) {
 		return;
 	}
+	/* SysTick cannot interrupt us here, use the cycle counter (enabled in
+	 * setup) for timing, the MCU runs at 120 MHz like in timer_init */
+	static uint32_t erase_us_left;
+	uint32_t start = dwt_read_cycle_counter();
 	flash_erase_sector(sector, FLASH_CR_PROGRAM_X32);
+	uint32_t erase_us = (dwt_read_cycle_counter() - start) / 120;
+	flash_stats.erase_count++;
+	flash_stats.erase_us += erase_us;
+	/* catch up with the SysTick interrupts missed during the erase */
+	erase_us_left += erase_us;
+	system_millis += erase_us_left / 1000;
+	erase_us_left %= 1000;
+}
+
+#define SRAM_BASE	(0x20000000U)
+#define SRAM_LEN	(128 * 1024)
+
+static bool svhandler_readable(uint32_t start, uint32_t len) {
+	if (start >= FLASH_ORIGIN && start - FLASH_ORIGIN <= FLASH_TOTAL_SIZE) {
+		return len <= FLASH_ORIGIN + FLASH_TOTAL_SIZE - start;
+	}
+	if (start >= SRAM_BASE && start - SRAM_BASE <= SRAM_LEN) {
+		return len <= SRAM_BASE + SRAM_LEN - start;
+	}
+	return false;
+}
+
+static uint32_t svhandler_flash_program_words(uint32_t addr, const uint32_t *src, uint32_t nwords) {
+	/* we only allow programming meta sectors 2 and 3 from flash or SRAM. */
+	if (addr % sizeof(uint32_t) != 0
+		|| addr < FLASH_META_START || addr > FLASH_APP_START
+		|| nwords > (FLASH_APP_START - addr) / sizeof(uint32_t)
+		|| !svhandler_readable((uint32_t) src, nwords * sizeof(uint32_t))) {
+		return FLASH_SR_WRPERR;
+	}
+	/* keep the program size set by svc_flash_program for later writes */
+	uint32_t cr = FLASH_CR & (FLASH_CR_PG | (FLASH_CR_PROGRAM_MASK << FLASH_CR_PROGRAM_SHIFT));
+	uint32_t status = flash_program_words(addr, src, nwords);
+	FLASH_CR = (FLASH_CR & ~(FLASH_CR_PROGRAM_MASK << FLASH_CR_PROGRAM_SHIFT)) | cr;
+	return status;
 }
 
 static uint32_t svhandler_flash_lock(void) {
@@ -63,8 +106,6 @@ static uint32_t svhandler_flash_lock(void) {
 	return FLASH_SR;
 }
 
-extern volatile uint32_t system_millis;
-
 void svc_handler_main(uint32_t *stack) {
 	uint8_t svc_number = ((uint8_t*) stack[6])[-2];
 	switch (svc_number) {
@@ -77,6 +118,9 @@ void svc_handler_main(uint32_t *stack) {
 	case SVC_FLASH_ERASE:
 		svhandler_flash_erase_sector(stack[0]);
 		break;
+	case SVC_FLASH_PROGRAM_WORDS:
+		stack[0] = svhandler_flash_program_words(stack[0], (const uint32_t *) stack[1], stack[2]);
+		break;
 	case SVC_FLASH_LOCK:
 		stack[0] = svhandler_flash_lock();
 		break;
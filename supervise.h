@@ -27,6 +27,7 @@
 #define SVC_FLASH_PROGRAM 2
 #define SVC_FLASH_LOCK    3
 #define SVC_TIMER_MS      4
+#define SVC_FLASH_PROGRAM_WORDS 5
 
 /* Unlocks flash.  This function needs to be called before programming
  * or erasing. Multiple calls of flash_program and flash_erase can
@@ -54,6 +55,18 @@ inline void svc_flash_erase_sector(uint8_t sector) {
 	__asm__ __volatile__ ("svc %0" :: "i" (SVC_FLASH_ERASE), "r" (r0) : "memory");
 }
 
+/* Program a span of 32-bit words into the meta sectors in a single
+ * supervisor call. The program size set by svc_flash_program is kept.
+ * @return flash status register (FLASH_SR)
+ */
+inline uint32_t svc_flash_program_words(uint32_t addr, const uint32_t *src, uint32_t nwords) {
+	register uint32_t r0 __asm__("r0") = addr;
+	register const uint32_t *r1 __asm__("r1") = src;
+	register uint32_t r2 __asm__("r2") = nwords;
+	__asm__ __volatile__ ("svc %1" : "+r" (r0) : "i" (SVC_FLASH_PROGRAM_WORDS), "r" (r1), "r" (r2) : "memory");
+	return r0;
+}
+
 /* Lock flash after programming or erasing.
  * @return flash status register (FLASH_SR)
  */
@@ -74,6 +87,7 @@ inline uint32_t svc_timer_ms(void) {
 extern void svc_flash_unlock(void);
 extern void svc_flash_program(uint32_t program_size);
 extern void svc_flash_erase_sector(uint16_t sector);
+extern uint32_t svc_flash_program_words(uint32_t addr, const uint32_t *src, uint32_t nwords);
 extern uint32_t svc_flash_lock(void);
 extern uint32_t svc_timer_ms(void);
 